@@ -1,17 +1,286 @@
 // roguelike.cpp
 // Single-file tiny roguelike with difficulty, potions, high score, and basic enemy pathing.
-// Compile: g++ -std=c++17 -O2 -o roguelike roguelike.cpp
-// Run: ./roguelike
+// Compile: g++ -std=c++17 -O2 -pthread -o roguelike game.cpp    (add -march=native for the AVX2 flood fill)
+// Run: ./roguelike [--size WxH] [--seed S]    (map size, default 20x10; a fixed seed replays the same dungeon)
+//      ./roguelike --load FILE    resumes a game saved with 'p'
+//      add --record FILE to log the session's inputs and per-turn state hashes as a replay
+//      add --events FILE to log every combat and pickup event as binary records (see EVENT_MAGIC)
+//      ./roguelike --explore DIR    one endless floor generated chunk by chunk as you walk; chunks far
+//                                   behind are parked in DIR (no saving or recording)
+// Server: ./roguelike --serve PORT [--diff 1|2|3] [--size WxH] [--seed S] [--config FILE] [--scores FILE]
+//                         one game per TCP connection, commands and map deltas as text lines (see run_server)
+// Replay: ./roguelike --replay FILE|DIR [--replay ...]    re-runs replays headless, checking every turn
+// Headless: ./roguelike --sim N [--seed S] [--threads T] [--diff 1|2|3] [--max-turns T] [--floors F] [--script wasd...]
+//                         [--scores FILE]    (also submit every result to the leaderboard in FILE)
+//                         [--record DIR]     (write each game's replay to DIR/game_<i>.rpl)
+//                         [--explore DIR]    (endless worlds; worker t parks chunks in DIR/worker_<t>)
+//                         [--profile FILE]   (per-phase times, search nodes, allocations and turn latency as JSON;
+//                                             also accepted by interactive games)
+//   plays N games with the chase AI (or a looping w/a/s/d script) and reports games/sec and turns/sec.
+//   A game covers F floors (default 1); interactive games descend without limit.
+// Stress: ./roguelike --stress SECONDS [--seed S] [--threads T]    random extreme games (huge maps, crowds,
+//         no potions, endless worlds) checked for broken invariants every turn; --stress-game I replays game I
+// Difficulty values: --config FILE overrides them for interactive and --sim games; see load_diff_config.
+// Benchmarks: ./roguelike --bench [--seed S]    ns/op and allocations/op for pathfinding, generation and turns.
 //
-// Controls: w=up a=left s=down d=right (press key + Enter). q to quit.
-// Pick difficulty at start. Potions '!' heal 6-10 HP (capped). Enemies 'E' pathfind one tile toward player.
+// Controls: w=up a=left s=down d=right (press key + Enter). p saves to savegame.bin. q to quit.
+// Pick difficulty at start. Potions '!' heal 6-10 HP (capped). Enemies 'E' pathfind one tile toward player;
+// enemies out of your sight are dormant and only move every 4th turn.
 // Score +10 per kill. High score saved to highscore.txt.
 
 #include <bits/stdc++.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 using namespace std;
 
+// Heap allocation counter, read by --bench to report allocations/op. One thread-local
+// increment per allocation; build with -DROGUE_NO_ALLOC_COUNT to use the stock operator new.
+thread_local uint64_t tl_allocs = 0;
+#ifndef ROGUE_NO_ALLOC_COUNT
+void *operator new(size_t n){
+    tl_allocs++;
+    if(void *p = malloc(n ? n : 1)) return p;
+    throw bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+#endif
+
+// Turn profiler. Each thread accumulates time per phase, search nodes expanded, allocations
+// and a turn latency histogram in tl_profile; reporters merge the per-thread copies and export
+// JSON (--profile FILE). A probe is one steady_clock read per phase switch plus a few adds, so
+// it stays on in sims; build with -DROGUE_NO_PROFILE to compile every probe out.
+enum Phase { PH_INPUT, PH_PLAYER, PH_PLAN, PH_RESOLVE, PH_COLLIDE, PH_DESCEND, PH_RENDER, PH_COUNT };
+const char *const PHASE_NAMES[PH_COUNT] = {"input", "player", "plan", "resolve", "collide", "descend", "render"};
+
+// Log-linear buckets: exact below 8ns, then 8 buckets per power of two (at most 12.5% wide).
+struct LatencyHistogram {
+    static const int SUB = 8;
+    uint64_t counts[64*SUB] = {};
+    uint64_t total = 0, maxNs = 0;
+
+    static int bucket(uint64_t ns){
+        if(ns < SUB) return (int)ns;
+        int msb = 63 - __builtin_clzll(ns);
+        return (msb-2)*SUB + (int)((ns >> (msb-3)) & (SUB-1));
+    }
+    static uint64_t lower_bound(int b){
+        if(b < SUB) return (uint64_t)b;
+        int msb = b/SUB + 2;
+        return (uint64_t)(SUB + b%SUB) << (msb-3);
+    }
+    void add(uint64_t ns){ counts[bucket(ns)]++; total++; maxNs = max(maxNs, ns); }
+    void merge(const LatencyHistogram &o){
+        for(int i=0;i<64*SUB;i++) counts[i] += o.counts[i];
+        total += o.total; maxNs = max(maxNs, o.maxNs);
+    }
+    // q in (0,1]; the lower edge of the bucket holding that quantile
+    uint64_t percentile(double q) const {
+        uint64_t want = (uint64_t)ceil(q * (double)total), seen = 0;
+        for(int i=0;i<64*SUB;i++){ seen += counts[i]; if(seen >= want && seen) return lower_bound(i); }
+        return 0;
+    }
+};
+
+struct Profile {
+    uint64_t phaseNs[PH_COUNT] = {}, phaseCalls[PH_COUNT] = {};
+    uint64_t turns = 0, nodes = 0, allocs = 0;
+    LatencyHistogram turnNs;
+
+    void merge(const Profile &o){
+        for(int i=0;i<PH_COUNT;i++){ phaseNs[i] += o.phaseNs[i]; phaseCalls[i] += o.phaseCalls[i]; }
+        turns += o.turns; nodes += o.nodes; allocs += o.allocs;
+        turnNs.merge(o.turnNs);
+    }
+    void write_json(FILE *f) const {
+        double t = max<uint64_t>(turns, 1);
+        fprintf(f, "{\n  \"turns\": %llu,\n  \"phases\": {", (unsigned long long)turns);
+        for(int i=0;i<PH_COUNT;i++)
+            fprintf(f, "%s\n    \"%s\": {\"calls\": %llu, \"total_ns\": %llu, \"ns_per_call\": %.1f}", i ? "," : "",
+                    PHASE_NAMES[i], (unsigned long long)phaseCalls[i], (unsigned long long)phaseNs[i],
+                    phaseCalls[i] ? (double)phaseNs[i]/phaseCalls[i] : 0.0);
+        fprintf(f, "\n  },\n  \"nodes_per_turn\": %.2f,\n  \"allocs_per_turn\": %.3f,\n", nodes/t, allocs/t);
+        fprintf(f, "  \"turn_ns\": {\"p50\": %llu, \"p99\": %llu, \"max\": %llu}\n}\n",
+                (unsigned long long)turnNs.percentile(0.5), (unsigned long long)turnNs.percentile(0.99),
+                (unsigned long long)turnNs.maxNs);
+    }
+    bool save_json(const string &path) const {
+        FILE *f = fopen(path.c_str(), "w");
+        if(!f) return false;
+        write_json(f);
+        return fclose(f) == 0;
+    }
+};
+
+thread_local Profile tl_profile;
+
+#ifndef ROGUE_NO_PROFILE
+inline uint64_t prof_now(){
+    return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+// Times consecutive phases of one scope: switch_to() closes the running phase and opens the
+// next; stop() or the destructor closes the last one.
+struct PhaseClock {
+    int phase = -1;
+    uint64_t t0 = 0;
+    void switch_to(int ph){
+        uint64_t now = prof_now();
+        if(phase >= 0){ tl_profile.phaseNs[phase] += now - t0; tl_profile.phaseCalls[phase]++; }
+        phase = ph; t0 = now;
+    }
+    void stop(){ if(phase >= 0) switch_to(-1); }
+    ~PhaseClock(){ stop(); }
+};
+// One game turn: latency and allocations made while it runs.
+struct TurnClock {
+    uint64_t t0 = prof_now(), allocs0 = tl_allocs;
+    ~TurnClock(){
+        tl_profile.turns++;
+        tl_profile.turnNs.add(prof_now() - t0);
+        tl_profile.allocs += tl_allocs - allocs0;
+    }
+};
+#define PROFILE_PHASES(clk) PhaseClock clk
+#define PROFILE_SWITCH(clk, ph) clk.switch_to(ph)
+#define PROFILE_STOP(clk) clk.stop()
+#define PROFILE_TURN() TurnClock turnClock
+#define PROFILE_NODES(n) (tl_profile.nodes += (uint64_t)(n))
+#else
+#define PROFILE_PHASES(clk) ((void)0)
+#define PROFILE_SWITCH(clk, ph) ((void)0)
+#define PROFILE_STOP(clk) ((void)0)
+#define PROFILE_TURN() ((void)0)
+#define PROFILE_NODES(n) ((void)0)
+#endif
+
+// default map size; --size WxH picks another one at startup
 const int MAP_W = 20;
 const int MAP_H = 10;
+const int MIN_MAP_W = 10; // widest room (8) plus the wall border
+const int MIN_MAP_H = 7;  // tallest room (5) plus the wall border
+
+// Level memory. Everything one floor owns (grid, rooms, entity arrays, pathfinding scratch) is a
+// LevelVec allocating from that floor's LevelArena: a bump allocator over large blocks, so
+// building a floor is a run of pointer increments and regenerating it drops the whole floor at
+// once. Freeing a single buffer is a no-op; the arena is only ever emptied whole, by release(),
+// which keeps its memory for the next floor. Blocks of destroyed arenas go on a shared
+// freelist (arenaPool), so games, pipelines and BatchEnv games coming and going do not go back
+// to malloc for every floor either. A LevelVec built without an arena uses the heap, like a
+// vector; copies always do.
+struct ArenaBlock { char *data = nullptr; size_t size = 0; };
+
+struct ArenaPool {
+    static constexpr size_t MIN_BLOCK = 16 << 10;      // a 20x10 floor takes about 13K
+    static constexpr size_t MAX_FREE_BYTES = 8 << 20;  // kept for reuse; past that blocks are freed
+    mutex m;
+    vector<ArenaBlock> blocks;
+    size_t freeBytes = 0;
+
+    ~ArenaPool(){ for(auto &b: blocks) ::operator delete(b.data); }
+    // a block of at least `bytes`: the smallest free one that fits, else a new one
+    ArenaBlock take(size_t bytes){
+        {
+            lock_guard<mutex> lk(m);
+            size_t best = blocks.size();
+            for(size_t i=0;i<blocks.size();i++)
+                if(blocks[i].size >= bytes && (best == blocks.size() || blocks[i].size < blocks[best].size)) best = i;
+            if(best < blocks.size()){
+                ArenaBlock b = blocks[best];
+                freeBytes -= b.size;
+                blocks[best] = blocks.back();
+                blocks.pop_back();
+                return b;
+            }
+        }
+        size_t size = (max(bytes, MIN_BLOCK) + MIN_BLOCK - 1) / MIN_BLOCK * MIN_BLOCK;
+        return {static_cast<char*>(::operator new(size)), size};
+    }
+    void give(ArenaBlock b){
+        {
+            lock_guard<mutex> lk(m);
+            if(freeBytes + b.size <= MAX_FREE_BYTES){ blocks.push_back(b); freeBytes += b.size; return; }
+        }
+        ::operator delete(b.data);
+    }
+};
+ArenaPool arenaPool;
+
+struct LevelArena {
+    vector<ArenaBlock> blocks; // the last one is being filled
+    size_t used = 0;           // bytes handed out from the last block
+    size_t spent = 0;          // total size of the blocks before it
+
+    LevelArena() = default;
+    LevelArena(const LevelArena&) = delete;
+    LevelArena &operator=(const LevelArena&) = delete;
+    ~LevelArena(){ for(auto &b: blocks) arenaPool.give(b); }
+
+    // align is at most alignof(max_align_t), which operator new guarantees for a block start
+    void *allocate(size_t bytes, size_t align){
+        size_t at = (used + align - 1) & ~(align - 1);
+        if(blocks.empty() || at + bytes > blocks.back().size){
+            // grow by half of what the floor holds so far, however large the last request was
+            if(!blocks.empty()) spent += blocks.back().size;
+            blocks.push_back(arenaPool.take(max(bytes, spent / 2)));
+            at = 0;
+        }
+        used = at + bytes;
+        return blocks.back().data + at;
+    }
+    // forgets everything allocated so far. O(1) unless the last floor outgrew the first block;
+    // then its blocks are freed for one sized to what it used, so a like floor fits in one.
+    // Those go straight back to the heap: the growth series is mostly dead weight in the pool.
+    void release(){
+        if(blocks.size() > 1){
+            size_t need = spent + used;
+            for(auto &b: blocks) ::operator delete(b.data);
+            blocks.clear();
+            blocks.push_back(arenaPool.take(need));
+        }
+        used = spent = 0;
+    }
+};
+
+// The arena travels with the buffer when a LevelVec is moved or swapped, so two floors can
+// trade buffers (LevelPipeline::take) whatever arena each was built in.
+template<class T>
+struct LevelAlloc {
+    using value_type = T;
+    using propagate_on_container_move_assignment = true_type;
+    using propagate_on_container_swap = true_type;
+    LevelArena *arena = nullptr; // null: the heap
+
+    LevelAlloc() = default;
+    explicit LevelAlloc(LevelArena *a) : arena(a) {}
+    template<class U> LevelAlloc(const LevelAlloc<U> &o) : arena(o.arena) {}
+    T *allocate(size_t n){
+        return static_cast<T*>(arena ? arena->allocate(n * sizeof(T), alignof(T)) : ::operator new(n * sizeof(T)));
+    }
+    void deallocate(T *p, size_t){ if(!arena) ::operator delete(p); }
+    LevelAlloc select_on_container_copy_construction() const { return LevelAlloc(); }
+    template<class U> bool operator==(const LevelAlloc<U> &o) const { return arena == o.arena; }
+    template<class U> bool operator!=(const LevelAlloc<U> &o) const { return arena != o.arena; }
+};
+template<class T> using LevelVec = vector<T, LevelAlloc<T>>;
+
+// drops each buffer and has it allocate from arena a from now on
+template<class... V>
+void level_adopt(LevelArena *a, V&... v){ ((v = V(typename V::allocator_type(a))), ...); }
 
 struct Rect { int x,y,w,h; int centerX()const{return x+w/2;} int centerY()const{return y+h/2;} 
     bool intersects(const Rect& r) const {
@@ -19,15 +288,135 @@ struct Rect { int x,y,w,h; int centerX()const{return x+w/2;} int centerY()const{
     }
 };
 
-struct Enemy { int x,y; int hp; bool alive; };
+// Live enemies as parallel arrays (x[i], y[i], hp[i]). Dead enemies are removed at once by
+// swap-and-pop, so every loop over enemies touches only live positions and has no alive check.
+// Removal reorders: Occupancy::kill_enemy keeps the occupancy layer in sync.
+struct EnemyList {
+    LevelVec<int> x, y, hp;
+
+    void adopt(LevelArena *a){ level_adopt(a, x, y, hp); }
+    size_t size() const { return x.size(); }
+    bool empty() const { return x.empty(); }
+    void clear(){ x.clear(); y.clear(); hp.clear(); }
+    void reserve(size_t n){ x.reserve(n); y.reserve(n); hp.reserve(n); }
+    void push(int ex, int ey, int ehp){ x.push_back(ex); y.push_back(ey); hp.push_back(ehp); }
+    // the last enemy moves into slot i
+    void remove(size_t i){
+        x[i] = x.back(); y[i] = y.back(); hp[i] = hp.back();
+        x.pop_back(); y.pop_back(); hp.pop_back();
+    }
+};
 
 struct Item { int x,y; }; // only health potions
 
-using Grid = array<array<char, MAP_W>, MAP_H>;
+// The corridor carved from room i to room i+1: from the centre of room i along one axis to the
+// corner, then along the other axis to the centre of room i+1 (either leg may be empty).
+struct Corridor { int cornerX, cornerY; };
+
+// Map storage sized at runtime: one contiguous row-major buffer of terrain bits with a
+// one-cell wall border on every side, so x-1/x+1/y-1/y+1 of any map tile is always a valid
+// index and hot loops need no bounds checks. Glyphs are derived when rendering.
+// Cells are addressed either as (x,y) in map coordinates or by padded index idx(x,y);
+// the four neighbours of index i are i+1, i-1, i+stride, i-stride.
+const uint8_t CELL_FLOOR = 1;
+struct Grid {
+    int w=0, h=0, stride=0;
+    LevelVec<uint8_t> cells;
+
+    void adopt(LevelArena *a){ level_adopt(a, cells); }
+    void resize(int width, int height){
+        w = width; h = height; stride = w + 2;
+        cells.assign((size_t)stride * (h + 2), 0);
+    }
+    int size() const { return (int)cells.size(); }
+    int idx(int x,int y) const { return (y+1)*stride + (x+1); }
+    int x_of(int i) const { return i % stride - 1; }
+    int y_of(int i) const { return i / stride - 1; }
+    bool in_bounds(int x,int y) const { return x>=0 && x<w && y>=0 && y<h; }
+    // valid for the border ring too, which is always wall
+    bool floor(int x,int y) const { return cells[idx(x,y)] & CELL_FLOOR; }
+    bool floor_at(int i) const { return cells[i] & CELL_FLOOR; }
+    char glyph(int x,int y) const { return floor(x,y) ? '.' : '#'; }
+};
+
+// Per-cell occupancy layers, indexed like Grid cells: the index of the enemy or the
+// item standing on each tile, or -1. Kept in sync as enemies move and die and items are
+// picked up, so "who is on (x,y)" is a single load.
+struct Occupancy {
+    LevelVec<int> enemy, item;
+
+    void adopt(LevelArena *a){ level_adopt(a, enemy, item); }
+    void reset(const Grid &map, const EnemyList &enemies, const LevelVec<Item> &items){
+        enemy.assign(map.size(), -1);
+        item.assign(map.size(), -1);
+        for(size_t i=0;i<enemies.size();++i) enemy[map.idx(enemies.x[i], enemies.y[i])] = (int)i;
+        for(size_t i=0;i<items.size();++i) item[map.idx(items[i].x, items[i].y)] = (int)i;
+    }
+    void move_enemy(const Grid &map, int i, int fromX, int fromY, int toX, int toY){
+        int from = map.idx(fromX,fromY);
+        if(enemy[from]==i) enemy[from] = -1;
+        enemy[map.idx(toX,toY)] = i;
+    }
+    // swap-and-pop removal, like remove_item
+    void kill_enemy(const Grid &map, EnemyList &enemies, int i){
+        int c = map.idx(enemies.x[i], enemies.y[i]);
+        if(enemy[c]==i) enemy[c] = -1;
+        int last = (int)enemies.size()-1;
+        if(i != last) enemy[map.idx(enemies.x[last], enemies.y[last])] = i;
+        enemies.remove(i);
+    }
+    // swap-and-pop removal; the item moved into slot i keeps its tile
+    void remove_item(const Grid &map, LevelVec<Item> &items, int i){
+        item[map.idx(items[i].x, items[i].y)] = -1;
+        if(i != (int)items.size()-1){
+            items[i] = items.back();
+            item[map.idx(items[i].x, items[i].y)] = i;
+        }
+        items.pop_back();
+    }
+};
 
 // RNG
-static std::mt19937 rng((unsigned)chrono::high_resolution_clock::now().time_since_epoch().count());
-int rnd(int a,int b){ std::uniform_int_distribution<int> d(a,b); return d(rng); }
+// Every game owns its generator (Game::rng), so independent games can run on separate threads
+// and a game is fully reproducible from its seed.
+// PCG32 (XSH-RR): 16 bytes of state. below() uses Lemire's multiply-shift, so ranges are drawn
+// without building a distribution object and almost never divide.
+struct Rng {
+    uint64_t state = 0, inc = 1;
+
+    Rng(){ seed(0); }
+    explicit Rng(uint64_t s){ seed(s); }
+    void seed(uint64_t s, uint64_t stream = 0xDA3E39CB94B95BDBull){
+        state = 0; inc = (stream << 1) | 1;
+        next(); state += s; next();
+    }
+    uint32_t next(){
+        uint64_t old = state;
+        state = old * 6364136223846793005ull + inc;
+        uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+        uint32_t rot = (uint32_t)(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+    }
+    // uniform in [0, n), n > 0
+    uint32_t below(uint32_t n){
+        uint64_t m = (uint64_t)next() * n;
+        uint32_t low = (uint32_t)m;
+        if(low < n){
+            uint32_t threshold = (0u - n) % n;
+            while(low < threshold){ m = (uint64_t)next() * n; low = (uint32_t)m; }
+        }
+        return (uint32_t)(m >> 32);
+    }
+};
+// uniform in [a, b]
+int rnd(Rng &rng, int a,int b){ return a + (int)rng.below((uint32_t)(b - a) + 1u); }
+// splitmix64: derives well-spread per-game seeds from one base seed
+uint64_t mix_seed(uint64_t x){
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
 
 // Difficulty config
 enum Difficulty { EASY=0, NORMAL=1, HARD=2 };
@@ -37,399 +426,3573 @@ struct DiffConfig {
     int enemyAtkMin, enemyAtkMax;
     int potionMin, potionMax;
 };
-DiffConfig diffConfigs[3];
+// fields: enemy count, hp range, atk range, potion count. Read-only, shared by every game;
+// --config FILE replaces them for the games of one run (see load_diff_config).
+constexpr DiffConfig diffConfigs[3] = {
+    {2,4, 3,5, 1,2, 5,7},   // EASY
+    {3,6, 4,8, 2,3, 3,5},   // NORMAL
+    {5,8, 6,12, 3,5, 1,3},  // HARD
+};
+static_assert(sizeof(DiffConfig) == 8 * sizeof(int), "DiffConfig is read and written as 8 ints");
+bool operator==(const DiffConfig &a, const DiffConfig &b){ return memcmp(&a, &b, sizeof a) == 0; }
+
+// uniform in [A, B] with the bounds known at compile time
+template<int A, int B>
+int rnd_fixed(Rng &rng){
+    static_assert(A <= B, "empty range");
+    return A + (int)rng.below((uint32_t)(B - A) + 1u);
+}
+
+// Difficulty policies for step(). FixedDiff<D> bakes a built-in config in as constants, so each
+// instantiation of the turn folds its ranges into the rolls; RuntimeDiff carries a config
+// loaded at run time behind the same interface.
+template<Difficulty D>
+struct FixedDiff {
+    static constexpr DiffConfig cfg = diffConfigs[D];
+    int attack_roll(Rng &rng) const { return rnd_fixed<cfg.enemyAtkMin, cfg.enemyAtkMax>(rng); }
+};
+struct RuntimeDiff {
+    DiffConfig cfg;
+    int attack_roll(Rng &rng) const { return rnd(rng, cfg.enemyAtkMin, cfg.enemyAtkMax); }
+};
+
+// Whether every range of c is non-empty and its counts and rolls are non-negative, with at
+// least 1 HP per enemy. Checked on configs read from a file, a save or a replay.
+bool valid_config(const DiffConfig &c){
+    return c.enemyMin >= 0 && c.enemyMin <= c.enemyMax && c.enemyHpMin >= 1 && c.enemyHpMin <= c.enemyHpMax &&
+           c.enemyAtkMin >= 0 && c.enemyAtkMin <= c.enemyAtkMax && c.potionMin >= 0 && c.potionMin <= c.potionMax;
+}
+
+// Config file: "<easy|normal|hard>.<field> = <value>" lines, '#' starts a comment. Fields are
+// enemy_min/max, enemy_hp_min/max, enemy_atk_min/max and potion_min/max; anything not listed
+// keeps its value in table. Prints the offending line and returns false on bad input.
+bool load_diff_config(const string &path, DiffConfig table[3]){
+    ifstream ifs(path);
+    if(!ifs){ cerr << "Could not read config " << path << "\n"; return false; }
+    static const char *const diffNames[3] = {"easy", "normal", "hard"};
+    static const struct { const char *name; int DiffConfig::*field; } fields[8] = {
+        {"enemy_min", &DiffConfig::enemyMin}, {"enemy_max", &DiffConfig::enemyMax},
+        {"enemy_hp_min", &DiffConfig::enemyHpMin}, {"enemy_hp_max", &DiffConfig::enemyHpMax},
+        {"enemy_atk_min", &DiffConfig::enemyAtkMin}, {"enemy_atk_max", &DiffConfig::enemyAtkMax},
+        {"potion_min", &DiffConfig::potionMin}, {"potion_max", &DiffConfig::potionMax},
+    };
+    DiffConfig next[3] = {table[0], table[1], table[2]};
+    string line;
+    for(int lineNo=1; getline(ifs, line); lineNo++){
+        line = line.substr(0, line.find('#'));
+        char diffName[16], field[32];
+        int value;
+        if(line.find_first_not_of(" \t\r") == string::npos) continue;
+        int d = -1, f = -1;
+        if(sscanf(line.c_str(), " %15[a-z].%31[a-z_] = %d", diffName, field, &value) == 3){
+            for(int i=0;i<3;i++) if(!strcmp(diffName, diffNames[i])) d = i;
+            for(int i=0;i<8;i++) if(!strcmp(field, fields[i].name)) f = i;
+        }
+        if(d < 0 || f < 0 || value < 0){ cerr << path << ":" << lineNo << ": bad setting: " << line << "\n"; return false; }
+        next[d].*fields[f].field = value;
+    }
+    for(int d=0;d<3;d++){
+        if(!valid_config(next[d])){
+            cerr << path << ": " << diffNames[d] << " has an empty or invalid range\n";
+            return false;
+        }
+    }
+    copy(next, next + 3, table);
+    return true;
+}
 
 // Map helpers
+// Carving clips its span against the map once, so the inner loops write unconditionally.
 void create_empty_map(Grid &map){
-    for(int y=0;y<MAP_H;y++) for(int x=0;x<MAP_W;x++) map[y][x] = '#';
+    fill(map.cells.begin(), map.cells.end(), 0);
 }
 void carve_room(Grid &map, const Rect &r){
-    for(int yy=r.y; yy<r.y+r.h; ++yy) for(int xx=r.x; xx<r.x+r.w; ++xx)
-        if (xx>=0 && xx<MAP_W && yy>=0 && yy<MAP_H) map[yy][xx]='.';
+    int x0 = max(r.x, 0), x1 = min(r.x + r.w, map.w);
+    int y0 = max(r.y, 0), y1 = min(r.y + r.h, map.h);
+    for(int yy=y0; yy<y1; ++yy){
+        uint8_t *row = &map.cells[map.idx(0,yy)];
+        for(int xx=x0; xx<x1; ++xx) row[xx] |= CELL_FLOOR;
+    }
 }
 void carve_h(Grid &map,int x1,int x2,int y){
     if(x2<x1) swap(x1,x2);
-    for(int x=x1;x<=x2;++x) if(x>=0 && x<MAP_W && y>=0 && y<MAP_H) map[y][x]='.';
+    if(y<0 || y>=map.h) return;
+    x1 = max(x1, 0); x2 = min(x2, map.w-1);
+    uint8_t *row = &map.cells[map.idx(0,y)];
+    for(int x=x1;x<=x2;++x) row[x] |= CELL_FLOOR;
 }
 void carve_v(Grid &map,int y1,int y2,int x){
     if(y2<y1) swap(y1,y2);
-    for(int y=y1;y<=y2;++y) if(x>=0 && x<MAP_W && y>=0 && y<MAP_H) map[y][x]='.';
+    if(x<0 || x>=map.w) return;
+    y1 = max(y1, 0); y2 = min(y2, map.h-1);
+    for(int y=y1;y<=y2;++y) map.cells[map.idx(x,y)] |= CELL_FLOOR;
 }
 
-pair<int,int> random_floor_tile(const Grid &map){
-    vector<pair<int,int>> floors;
-    for(int y=0;y<MAP_H;y++) for(int x=0;x<MAP_W;x++) if (map[y][x]=='.') floors.emplace_back(x,y);
-    if(floors.empty()) return {1,1};
-    return floors[rnd(0,(int)floors.size()-1)];
-}
+// Floor tiles of the current map as padded cell indices, built once per generation.
+// sample() draws without replacement by growing a partial Fisher-Yates prefix of the list,
+// so placing k entities costs O(k) and never has to retry on a clash.
+struct FloorList {
+    LevelVec<int> cells;
+    int taken = 0; // cells[0..taken) are already handed out
 
-// BFS pathfinding for single-step: returns next (nx,ny) from (sx,sy) to move one tile toward (tx,ty).
-// Avoid tiles not floor, and avoid cells occupied by other enemies (occupied vector).
-// If no path found, returns sx,sy (stay). If next tile is target (tx,ty), returns target.
-pair<int,int> bfs_next_step(const Grid &map, int sx, int sy, int tx, int ty, const vector<pair<int,int>>& occupied){
-    if (sx==tx && sy==ty) return {sx,sy};
-    // grid of visited
-    array<array<bool, MAP_W>, MAP_H> vis{};
-    array<array<pair<int,int>, MAP_W>, MAP_H> parent;
-    queue<pair<int,int>> q;
-    q.push({sx,sy}); vis[sy][sx] = true;
-    // mark occupied as blocked except the final target (player) — enemies can step onto player
-    auto blocked = [&](int x,int y)->bool{
-        if (x<0||x>=MAP_W||y<0||y>=MAP_H) return true;
-        if (map[y][x]!='.') {
-            // allow stepping into player's tile which may be on floor; if player is on floor it's fine, but we only allow '.' or player tile
-            // but map contains only '#' or '.' so if not '.' it's '#', blocked.
-            return true;
-        }
-        for(auto &p: occupied) if (p.first==x && p.second==y && !(x==tx && y==ty)) return true;
-        return false;
-    };
-    vector<pair<int,int>> dirs = {{1,0},{-1,0},{0,1},{0,-1}};
-    bool found=false;
-    while(!q.empty()){
-        auto cur = q.front(); q.pop();
-        if (cur.first==tx && cur.second==ty){ found = true; break; }
-        for(auto &d:dirs){
-            int nx = cur.first + d.first, ny = cur.second + d.second;
-            if(nx<0||nx>=MAP_W||ny<0||ny>=MAP_H) continue;
-            if(vis[ny][nx]) continue;
-            if(blocked(nx,ny)) continue;
-            vis[ny][nx]=true;
-            parent[ny][nx] = cur;
-            q.push({nx,ny});
-        }
-    }
-    if(!found) {
-        // try greedy fallback: step toward player in x or y if available (no BFS path)
-        int dx = (tx>sx)?1:((tx<sx)?-1:0);
-        int dy = (ty>sy)?1:((ty<sy)?-1:0);
-        // prefer larger delta
-        if (abs(tx-sx) >= abs(ty-sy)) {
-            if (!blocked(sx+dx, sy)) return {sx+dx, sy};
-            if (!blocked(sx, sy+dy)) return {sx, sy+dy};
-        } else {
-            if (!blocked(sx, sy+dy)) return {sx, sy+dy};
-            if (!blocked(sx+dx, sy)) return {sx+dx, sy};
+    void adopt(LevelArena *a){ level_adopt(a, cells); }
+    void build(const Grid &map){
+        cells.clear();
+        cells.reserve((size_t)map.w * map.h); // one arena bump instead of a chain of regrowths
+        taken = 0;
+        for(int y=0;y<map.h;y++){
+            int row = map.idx(0,y);
+            for(int x=0;x<map.w;x++) if(map.floor_at(row + x)) cells.push_back(row + x);
         }
-        return {sx,sy};
     }
-    // backtrack from target to start to find first step
-    pair<int,int> cur = {tx,ty};
-    pair<int,int> prev = parent[cur.second][cur.first];
-    while(!(prev.first==sx && prev.second==sy)){
-        cur = prev;
-        prev = parent[cur.second][cur.first];
+    int remaining() const { return (int)cells.size() - taken; }
+    // mark a cell as used without drawing it (e.g. the player's start tile)
+    void exclude(int cell){
+        for(int i=taken;i<(int)cells.size();i++) if(cells[i]==cell){ swap(cells[i], cells[taken++]); return; }
     }
-    return cur; // this is the first step from start
-}
+    // a distinct unused floor cell, or -1 when none are left
+    int sample(Rng &rng){
+        if(remaining() <= 0) return -1;
+        int j = taken + (int)rng.below((uint32_t)remaining());
+        swap(cells[taken], cells[j]);
+        return cells[taken++];
+    }
+};
 
-// Render & UI
-void print_header(){
-    cout << "=== Tiny Roguelike ===\n";
-    cout << "Controls: w=up a=left s=down d=right    q=quit\n";
-    cout << "Objective: survive, kill enemies (score +10 per kill), pick potions '!' to heal.\n";
-    cout << "High score saved in highscore.txt\n\n";
+// any floor tile, with replacement
+pair<int,int> random_floor_tile(const Grid &map, const FloorList &floors, Rng &rng){
+    if(floors.cells.empty()) return {1,1};
+    int c = floors.cells[rng.below((uint32_t)floors.cells.size())];
+    return {map.x_of(c), map.y_of(c)};
 }
 
-void render(const Grid &map, const vector<Enemy>& enemies, const vector<Item>& items,
-            int px,int py,int playerHP,int playerMaxHP,int score,int turns,int highScore, Difficulty diff) {
-    print_header();
-    string diffName = (diff==EASY?"Easy":(diff==NORMAL?"Normal":"Hard"));
-    cout << "Diff: " << diffName << "    HP: " << playerHP << "/" << playerMaxHP
-         << "    Score: " << score << "    Turns: " << turns << "    High: " << highScore << "\n\n";
-    Grid draw = map;
-    for(auto &it: items) if (it.x>=0 && it.y>=0) draw[it.y][it.x] = '!';
-    for(auto &e: enemies) if (e.alive) draw[e.y][e.x] = 'E';
-    if (px>=0 && py>=0) draw[py][px] = '@';
-    for(int y=0;y<MAP_H;y++){
-        for(int x=0;x<MAP_W;x++) cout << draw[y][x];
-        cout << '\n';
+// Greedy fallback when there is no path: step toward (tx,ty) in x or y if available.
+// blocked(c) decides which padded cells can be entered.
+template<class Blocked>
+pair<int,int> greedy_step(const Grid &map, int sx, int sy, int tx, int ty, Blocked blocked){
+    int dx = (tx>sx)?1:((tx<sx)?-1:0);
+    int dy = (ty>sy)?1:((ty<sy)?-1:0);
+    // prefer larger delta
+    if (abs(tx-sx) >= abs(ty-sy)) {
+        if (!blocked(map.idx(sx+dx, sy))) return {sx+dx, sy};
+        if (!blocked(map.idx(sx, sy+dy))) return {sx, sy+dy};
+    } else {
+        if (!blocked(map.idx(sx, sy+dy))) return {sx, sy+dy};
+        if (!blocked(map.idx(sx+dx, sy))) return {sx+dx, sy};
     }
-    cout << '\n';
+    return {sx,sy};
 }
 
-// high score IO
-int load_high_score(const string &fname){
-    ifstream ifs(fname);
-    if(!ifs) return 0;
-    int h=0; ifs>>h; return h;
-}
-void save_high_score(const string &fname, int h){
-    ofstream ofs(fname);
-    if(!ofs){ cerr << "Warning: could not write high score\n"; return; }
-    ofs<<h<<"\n";
-}
+// Reachability over packed rows: bit x of row y is map tile (x,y), with a zero guard row above
+// and below the map. reach() grows the seen set to a fixed point by sweeping the rows down and
+// then up; each row first takes the seen bits of its neighbour rows (a whole-row vertical step,
+// 4 words per AVX2 op or 2 per NEON op) and then fills every floor run it touches in one go,
+// so a corridor costs one sweep instead of one BFS step per tile. It yields no distances;
+// DistanceField keeps a queue BFS for those.
+struct BitFlood {
+    int w=0, h=0, words=0;           // words per row, padded to a multiple of 4
+    int tiles=0;                     // floor tiles loaded
+    vector<uint64_t> floorBits, seen, tmp;
 
-// Global-ish: we will group generation code into regenerate_map
-void generate_map_basic(Grid &map, vector<Rect> &rooms) {
-    create_empty_map(map);
-    rooms.clear();
-    int maxRooms = 6;
-    int roomCount = rnd(3, maxRooms);
-    for(int i=0;i<roomCount;i++){
-        Rect r;
-        r.w = rnd(3,8);
-        r.h = rnd(3,5);
-        r.x = rnd(1, MAP_W - r.w - 1);
-        r.y = rnd(1, MAP_H - r.h - 1);
-        bool ok=true;
-        for(auto &o: rooms) if (r.intersects(o)) { ok=false; break; }
-        if(!ok){ i--; continue; }
-        carve_room(map, r);
-        if(!rooms.empty()){
-            int px = rooms.back().centerX(), py = rooms.back().centerY();
-            int cx = r.centerX(), cy = r.centerY();
-            if (rnd(0,1)==0){
-                carve_h(map, px, cx, py);
-                carve_v(map, py, cy, cx);
-            } else {
-                carve_v(map, py, cy, px);
-                carve_h(map, px, cx, cy);
+    void load(const Grid &map){
+        w = map.w; h = map.h;
+        words = ((w + 63) / 64 + 3) & ~3;
+        floorBits.assign((size_t)words * (h + 2), 0);
+        seen.assign(floorBits.size(), 0);
+        tmp.resize(words);
+        const uint8_t *cells = map.cells.data();
+        for(int y=0;y<h;y++){
+            uint64_t *r = row(floorBits, y);
+            const uint8_t *c = cells + map.idx(0,y);
+            int x = 0;
+            // eight cells at a time: the multiply gathers bit 0 of each byte into the top byte
+            for(; x + 8 <= w; x += 8){
+                uint64_t v;
+                memcpy(&v, c + x, 8);
+                r[x >> 6] |= (((v & 0x0101010101010101ull) * 0x0102040810204080ull) >> 56) << (x & 63);
             }
+            for(; x<w; x++) if(c[x] & CELL_FLOOR) r[x >> 6] |= 1ull << (x & 63);
         }
-        rooms.push_back(r);
+        tiles = 0;
+        for(uint64_t v: floorBits) tiles += __builtin_popcountll(v);
     }
-    // fallback to open floor if none
-    bool any=false;
-    for(int y=0;y<MAP_H;y++) for(int x=0;x<MAP_W;x++) if(map[y][x]=='.') any=true;
-    if(!any) for(int y=1;y<MAP_H-1;y++) for(int x=1;x<MAP_W-1;x++) map[y][x]='.';
-}
+    uint64_t *row(vector<uint64_t> &v, int y){ return v.data() + (size_t)(y + 1) * words; }
+    const uint64_t *row(const vector<uint64_t> &v, int y) const { return v.data() + (size_t)(y + 1) * words; }
+    bool reached(int x, int y){ return (row(seen, y)[x >> 6] >> (x & 63)) & 1; }
 
-// regenerate_map: builds map and places player, enemies and items according to difficulty
-void regenerate_map(Grid &map, vector<Rect> &rooms, int &playerX, int &playerY,
-                    vector<Enemy> &enemies, vector<Item> &items, Difficulty diff,
-                    int &playerMaxHP, int &playerAttack, int &enemyAttackDamage, int &potionHeal, int &score) {
-    // generate map
-    generate_map_basic(map, rooms);
+    // marks every floor tile reachable from (sx,sy) in seen and returns how many there are
+    int reach(int sx, int sy){
+        fill(seen.begin(), seen.end(), 0);
+        row(seen, sy)[sx >> 6] |= 1ull << (sx & 63);
+        fill_runs(row(seen, sy), row(floorBits, sy), words);
+        for(bool changed=true; changed; ){
+            changed = false;
+            for(int pass=0; pass<2; pass++)
+                for(int i=0;i<h;i++){
+                    int y = pass==0 ? i : h-1-i;
+                    uint64_t *s = row(seen, y);
+                    if(!grow_vertical(row(seen, y-1), s, row(seen, y+1), row(floorBits, y), tmp.data(), words)) continue;
+                    fill_runs(tmp.data(), row(floorBits, y), words);
+                    copy(tmp.begin(), tmp.end(), s);
+                    changed = true;
+                }
+        }
+        int n = 0;
+        for(uint64_t v: seen) n += __builtin_popcountll(v);
+        return n;
+    }
 
-    // place player at center of first room or random floor
-    if(!rooms.empty()){ playerX = rooms[0].centerX(); playerY = rooms[0].centerY(); }
-    else { auto p = random_floor_tile(map); playerX=p.first; playerY=p.second; }
+    // out = s | ((up | down) & floor); returns whether that added anything to s
+    static bool grow_vertical(const uint64_t *up, const uint64_t *s, const uint64_t *down, const uint64_t *fl,
+                              uint64_t *out, int words){
+#if defined(__AVX2__)
+        __m256i diff = _mm256_setzero_si256();
+        for(int k=0;k<words;k+=4){
+            __m256i c = _mm256_loadu_si256((const __m256i*)(s + k));
+            __m256i v = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(up + k)), _mm256_loadu_si256((const __m256i*)(down + k)));
+            __m256i x = _mm256_or_si256(c, _mm256_and_si256(v, _mm256_loadu_si256((const __m256i*)(fl + k))));
+            _mm256_storeu_si256((__m256i*)(out + k), x);
+            diff = _mm256_or_si256(diff, _mm256_xor_si256(x, c));
+        }
+        return !_mm256_testz_si256(diff, diff);
+#elif defined(__ARM_NEON)
+        uint64x2_t diff = vdupq_n_u64(0);
+        for(int k=0;k<words;k+=2){
+            uint64x2_t c = vld1q_u64(s + k);
+            uint64x2_t x = vorrq_u64(c, vandq_u64(vorrq_u64(vld1q_u64(up + k), vld1q_u64(down + k)), vld1q_u64(fl + k)));
+            vst1q_u64(out + k, x);
+            diff = vorrq_u64(diff, veorq_u64(x, c));
+        }
+        return (vgetq_lane_u64(diff, 0) | vgetq_lane_u64(diff, 1)) != 0;
+#else
+        uint64_t diff = 0;
+        for(int k=0;k<words;k++){
+            out[k] = s[k] | ((up[k] | down[k]) & fl[k]);
+            diff |= out[k] ^ s[k];
+        }
+        return diff != 0;
+#endif
+    }
+
+    // grows s to the whole floor runs it touches: a shift-and-mask (Kogge-Stone) fill inside each
+    // word, in both directions, with the run carried across word boundaries
+    static void fill_runs(uint64_t *s, const uint64_t *fl, int words){
+        uint64_t carry = 0;
+        for(int k=0;k<words;k++){
+            uint64_t g = fl[k], x = s[k] | (carry & g);
+            x |= g & (x << 1);  g &= g << 1;
+            x |= g & (x << 2);  g &= g << 2;
+            x |= g & (x << 4);  g &= g << 4;
+            x |= g & (x << 8);  g &= g << 8;
+            x |= g & (x << 16); g &= g << 16;
+            x |= g & (x << 32);
+            s[k] = x; carry = x >> 63;
+        }
+        carry = 0;
+        for(int k=words-1;k>=0;k--){
+            uint64_t g = fl[k], x = s[k] | ((carry << 63) & g);
+            x |= g & (x >> 1);  g &= g >> 1;
+            x |= g & (x >> 2);  g &= g >> 2;
+            x |= g & (x >> 4);  g &= g >> 4;
+            x |= g & (x >> 8);  g &= g >> 8;
+            x |= g & (x >> 16); g &= g >> 16;
+            x |= g & (x >> 32);
+            s[k] = x; carry = x & 1;
+        }
+    }
+};
 
-    // difficulty config lookup
-    DiffConfig cfg = diffConfigs[(int)diff];
+// Connected floor regions, labelled by union-find over the floor runs of BitFlood's packed rows:
+// id[c] is the region of padded cell c (-1 on walls, the border ring included), so whether one
+// tile can walk to another is two loads. Regions are numbered in scan order. Only walls count;
+// enemies blocking a corridor are not part of it. Rebuilt with the map; nothing here is saved.
+// label_components below floods from the player first and only runs the union-find when that
+// flood leaves tiles behind.
+struct Components {
+    LevelVec<int> id;
+    LevelVec<int> first, size;   // per region: its first cell in scan order and its tile count
+    int count = 0;
+    LevelVec<int> runX, runEnd;  // per floor run: first and one-past-last x, in scan order
+    LevelVec<int> rowRuns;       // runs of rows above y start at rowRuns[y]
+    LevelVec<int> parent;        // union-find over runs
+    LevelVec<int> runLabel;
 
-    // create enemies
-    enemies.clear();
-    int ecount = rnd(cfg.enemyMin, cfg.enemyMax);
-    for(int i=0;i<ecount;i++){
-        auto p = random_floor_tile(map);
-        if (p.first==playerX && p.second==playerY) { i--; continue; }
-        bool clash=false;
-        for(auto &e: enemies) if (e.x==p.first && e.y==p.second) clash=true;
-        if(clash){ i--; continue; }
-        Enemy en; en.x=p.first; en.y=p.second; en.hp = rnd(cfg.enemyHpMin, cfg.enemyHpMax); en.alive=true;
-        enemies.push_back(en);
+    void adopt(LevelArena *a){ level_adopt(a, id, first, size, runX, runEnd, rowRuns, parent, runLabel); }
+
+    // labels every region of the floor loaded into bits
+    void build(const Grid &map, const BitFlood &bits){
+        runX.clear(); runEnd.clear();
+        rowRuns.resize(map.h + 1);
+        // A run touches a run of the row above when their x ranges overlap. Run ids follow scan
+        // order and the smaller root wins every union, so a region's root is its first run.
+        for(int y=0;y<map.h;y++){
+            rowRuns[y] = (int)runX.size();
+            const uint64_t *r = bits.row(bits.floorBits, y);
+            for(int x=0;;){
+                int k = x >> 6;
+                uint64_t v = k < bits.words ? r[k] & (~0ull << (x & 63)) : 0;
+                while(!v && ++k < bits.words) v = r[k];
+                if(k >= bits.words) break;
+                x = k * 64 + __builtin_ctzll(v);
+                v = ~r[k] & (~0ull << (x & 63));
+                while(!v && ++k < bits.words) v = ~r[k];
+                int end = k < bits.words ? k * 64 + __builtin_ctzll(v) : bits.words * 64;
+                runX.push_back(x); runEnd.push_back(end);
+                x = end;
+            }
+        }
+        rowRuns[map.h] = (int)runX.size();
+        int runs = (int)runX.size();
+        parent.resize(runs);
+        runLabel.resize(runs);
+        for(int i=0;i<runs;i++) parent[i] = i;
+        for(int y=1;y<map.h;y++){
+            int j = rowRuns[y-1];
+            for(int i=rowRuns[y]; i<rowRuns[y+1]; i++){
+                while(j < rowRuns[y] && runEnd[j] <= runX[i]) j++;
+                for(int t=j; t<rowRuns[y] && runX[t] < runEnd[i]; t++) unite(t, i);
+            }
+        }
+        id.assign(map.size(), -1);
+        first.clear(); size.clear();
+        count = 0;
+        for(int y=0;y<map.h;y++)
+            for(int i=rowRuns[y]; i<rowRuns[y+1]; i++){
+                int r = find(i), label;
+                if(r == i){ label = count++; first.push_back(map.idx(runX[i], y)); size.push_back(0); }
+                else label = runLabel[r];
+                runLabel[i] = label;
+                fill(id.begin() + map.idx(runX[i], y), id.begin() + map.idx(runEnd[i], y), label);
+                size[label] += runEnd[i] - runX[i];
+            }
+    }
+    // labels for a map whose `tiles` floor tiles are known to form one region
+    void single(const Grid &map, int tiles){
+        const uint8_t *cells = map.cells.data();
+        id.resize(map.size());
+        for(int c=0;c<map.size();c++) id[c] = (cells[c] & CELL_FLOOR) ? 0 : -1;
+        first.assign(1, int(find_if(cells, cells + map.size(), [](uint8_t v){ return v & CELL_FLOOR; }) - cells));
+        size.assign(1, tiles);
+        count = 1;
     }
+    bool connected(int a, int b) const { return id[a] >= 0 && id[a] == id[b]; }
 
-    // items (potions)
-    items.clear();
-    int pcount = rnd(cfg.potionMin, cfg.potionMax);
-    for(int i=0;i<pcount;i++){
-        auto p = random_floor_tile(map);
-        if (p.first==playerX && p.second==playerY) { i--; continue; }
-        bool clash=false;
-        for(auto &it: items) if(it.x==p.first && it.y==p.second) clash=true;
-        for(auto &e: enemies) if(e.x==p.first && e.y==p.second) clash=true;
-        if(clash){ i--; continue; }
-        items.push_back({p.first,p.second});
+private:
+    int find(int c){
+        while(parent[c] != c){ parent[c] = parent[parent[c]]; c = parent[c]; } // path halving
+        return c;
+    }
+    void unite(int a, int b){
+        a = find(a); b = find(b);
+        if(a < b) parent[b] = a;
+        else if(b < a) parent[a] = b;
     }
+};
 
-    // player stats: we set defaults here; caller may override
-    playerMaxHP = 20;
-    playerAttack = 4;
-    // enemy attack damage choose base from config min..max for simplicity — we can take average
-    enemyAttackDamage = rnd(cfg.enemyAtkMin, cfg.enemyAtkMax);
-    potionHeal = 0; // unused; actual potion heal random 6-10 per pickup
-    score = 0;
+// Labels the regions of map. One flood from floor tile (sx,sy) settles the usual single-region
+// map; the union-find only runs when that flood leaves tiles behind.
+void label_components(Components &comps, const Grid &map, int sx, int sy){
+    static thread_local BitFlood flood; // keeps its buffers between levels
+    flood.load(map);
+    if(map.floor(sx,sy) && flood.reach(sx, sy) == flood.tiles) comps.single(map, flood.tiles);
+    else comps.build(map, flood);
 }
 
-int enemy_index_at(const vector<Enemy>& enemies, int x,int y){
-    for(size_t i=0;i<enemies.size();++i) if(enemies[i].alive && enemies[i].x==x && enemies[i].y==y) return (int)i;
-    return -1;
-}
-int item_index_at(const vector<Item>& items, int x,int y){
-    for(size_t i=0;i<items.size();++i) if(items[i].x==x && items[i].y==y) return (int)i;
-    return -1;
+// Joins every other region to the one holding floor tile (hx,hy) with an L-shaped corridor from
+// the region's first tile, then relabels. Returns the number of corridors carved.
+int repair_components(Grid &map, Components &comps, int hx, int hy){
+    int home = comps.id[map.idx(hx,hy)], carved = 0;
+    for(int k=0;k<comps.count;k++){
+        if(k == home) continue;
+        int x = map.x_of(comps.first[k]), y = map.y_of(comps.first[k]);
+        carve_h(map, x, hx, y);
+        carve_v(map, y, hy, hx);
+        carved++;
+    }
+    if(carved) label_components(comps, map, hx, hy);
+    return carved;
 }
 
-int main(){
-    ios::sync_with_stdio(false);
-    cin.tie(nullptr);
+// Reusable buffers for bfs_next_step. A cell counts as visited when its stamp equals gen, so
+// starting a new search is one increment instead of clearing the arrays.
+struct BfsScratch {
+    vector<uint32_t> visited;
+    vector<int> parent;
+    vector<int> queue;
+    uint32_t gen = 0;
 
-    // Setup difficulty configs
-    diffConfigs[(int)EASY] = {2,4, 3,5, 1,2, 5,7};   // enemy count, hp range, atk range, potion count (potionMin/potionMax stored in last two fields)
-    diffConfigs[(int)NORMAL] = {3,6, 4,8, 2,3, 3,5};
-    diffConfigs[(int)HARD] = {5,8, 6,12, 3,5, 1,3};
+    void begin(const Grid &map){
+        if((int)visited.size() != map.size()){
+            visited.assign(map.size(), 0);
+            parent.resize(map.size());
+            queue.resize(map.size());
+            gen = 0;
+        }
+        if(++gen == 0){ fill(visited.begin(), visited.end(), 0); gen = 1; }
+    }
+};
 
-    // Note: fields ordering in DiffConfig: enemyMin,enemyMax, enemyHpMin,enemyHpMax, enemyAtkMin,enemyAtkMax, potionMin,potionMax
+// BFS pathfinding for single-step: returns next (nx,ny) from (sx,sy) to move one tile toward (tx,ty).
+// Avoid tiles not floor, and avoid cells occupied by other enemies (occupancy layer).
+// If no path found, returns sx,sy (stay). If next tile is target (tx,ty), returns target.
+// With comps, a target in another region goes straight to the greedy fallback instead of
+// flooding the whole region first.
+pair<int,int> bfs_next_step(const Grid &map, int sx, int sy, int tx, int ty, const Occupancy &occ, BfsScratch &scratch,
+                            const Components *comps = nullptr){
+    if (sx==tx && sy==ty) return {sx,sy};
+    int start = map.idx(sx,sy), target = map.idx(tx,ty);
+    // mark occupied as blocked except the final target (player) — enemies can step onto player
+    auto blocked = [&](int c)->bool{
+        if (!map.floor_at(c)) return true; // walls, including the border ring
+        return occ.enemy[c]!=-1 && c!=target;
+    };
+    if(comps && !comps->connected(start, target)) return greedy_step(map, sx, sy, tx, ty, blocked);
+    // visited/parent per padded cell index; the wall border stops the flood at the map edge
+    scratch.begin(map);
+    vector<uint32_t> &vis = scratch.visited;
+    vector<int> &parent = scratch.parent;
+    const uint32_t gen = scratch.gen;
+    size_t head=0, tail=0;
+    scratch.queue[tail++] = start; vis[start] = gen;
+    const int dirs[4] = {1, -1, map.stride, -map.stride};
+    bool found=false;
+    while(head<tail){
+        int cur = scratch.queue[head++];
+        if (cur==target){ found = true; break; }
+        for(int d:dirs){
+            int n = cur + d;
+            if(vis[n]==gen) continue;
+            if(blocked(n)) continue;
+            vis[n]=gen;
+            parent[n] = cur;
+            scratch.queue[tail++] = n;
+        }
+    }
+    PROFILE_NODES(tail);
+    if(!found) return greedy_step(map, sx, sy, tx, ty, blocked);
+    // backtrack from target to start to find first step
+    int cur = target;
+    while(parent[cur] != start) cur = parent[cur];
+    return {map.x_of(cur), map.y_of(cur)}; // this is the first step from start
+}
 
-    // Choose difficulty
-    cout << "Choose difficulty: 1) Easy  2) Normal  3) Hard  : ";
-    int dchoice = 2;
-    if(!(cin>>dchoice)) return 0;
-    Difficulty diff = NORMAL;
-    if(dchoice==1) diff = EASY;
-    else if(dchoice==3) diff = HARD;
+// Player-rooted distance field. Shared by every enemy, which then only has to look at its
+// four neighbours. Walls are the only obstacles here; enemies blocking each other is handled
+// when the step is picked.
+// reset() sizes the buffers for a new floor; move_root() refills the field with one BFS
+// whenever the player has moved. A one-tile step of the root changes nearly every distance,
+// so repairing the field incrementally does not touch fewer cells than the flood does.
+// Buffers are indexed like Grid cells and kept between turns, so neither call allocates in
+// steady state.
+struct DistanceField {
+    static constexpr int UNREACHED = INT_MAX;
+    LevelVec<int> dist;
+    LevelVec<int> queue;              // BFS queue
+    int root=-1;
+    int dirs[4] = {0,0,0,0};
 
-    Grid map;
-    vector<Rect> rooms;
-    int playerX=1, playerY=1;
-    vector<Enemy> enemies;
-    vector<Item> items;
-    int playerMaxHP=20, playerAttack=4, enemyAttackDamage=2, potionHeal=8;
-    int score = 0;
+    void adopt(LevelArena *a){ level_adopt(a, dist, queue); }
+    void reset(const Grid &map, int px, int py){
+        int dd[4] = {1, -1, map.stride, -map.stride};
+        copy(dd, dd+4, dirs);
+        dist.resize(map.size());
+        queue.resize(map.size());
+        refill(map, px, py);
+    }
 
-    // regenerate map according to difficulty (initial placement)
-    regenerate_map(map, rooms, playerX, playerY, enemies, items, diff, playerMaxHP, playerAttack, enemyAttackDamage, potionHeal, score);
+    void move_root(const Grid &map, int px, int py){
+        if (map.idx(px,py)!=root) refill(map, px, py);
+    }
 
-    int playerHP = playerMaxHP;
-    int turns = 0;
-    const string hsFile = "highscore.txt";
-    int highScore = load_high_score(hsFile);
+    int at(const Grid &map, int x,int y) const { return dist[map.idx(x,y)]; }
 
-    // main loop
-    while(true){
-        render(map, enemies, items, playerX, playerY, playerHP, playerMaxHP, score, turns, highScore, diff);
-        if(playerHP <= 0){
-            cout << "You died! Final score: " << score << "   Turns: " << turns << "\n";
-            if (score > highScore) {
-                cout << "New high score!\n";
-                save_high_score(hsFile, score);
-            } else {
-                cout << "High score: " << highScore << "\n";
+private:
+    // plain BFS from (px,py) over the whole field
+    void refill(const Grid &map, int px, int py){
+        fill(dist.begin(), dist.end(), UNREACHED);
+        size_t head=0, tail=0;
+        root = map.idx(px,py);
+        dist[root] = 0;
+        queue[tail++] = root;
+        while(head<tail){
+            int cur = queue[head++];
+            int nd = dist[cur] + 1;
+            for(int d: dirs){
+                int n = cur + d;
+                if(!map.floor_at(n) || dist[n]!=UNREACHED) continue;
+                dist[n] = nd;
+                queue[tail++] = n;
             }
-            break;
         }
-        cout << "Enter move (w/a/s/d) or q to quit: ";
-        char ch; if(!(cin>>ch)) break;
-        if(ch=='q' || ch=='Q'){
-            cout << "Quitting. Final score: " << score << "\n";
-            if (score > highScore) {
-                cout << "New high score!\n";
-                save_high_score(hsFile, score);
+        PROFILE_NODES(tail);
+    }
+};
+
+// Single step for an enemy at (sx,sy) using the shared field: move to the neighbour closest
+// to the player. Free tiles are preferred; when every step down the field holds another enemy,
+// the enemy queues behind one of them and move resolution decides whether the line advances.
+// The player's tile (tx,ty) always counts as free.
+// Enemies the field cannot reach use the same greedy fallback as bfs_next_step.
+pair<int,int> field_next_step(const Grid &map, const DistanceField &field, int sx, int sy, int tx, int ty,
+                              const Occupancy &occ){
+    if (sx==tx && sy==ty) return {sx,sy};
+    const int target = map.idx(tx,ty);
+    auto blocked = [&](int c)->bool{
+        if (!map.floor_at(c)) return true;
+        return occ.enemy[c]!=-1 && c!=target;
+    };
+    int here = field.at(map,sx,sy);
+    if (here==DistanceField::UNREACHED) return greedy_step(map, sx, sy, tx, ty, blocked);
+    const int start = map.idx(sx,sy);
+    int best = start, behind = start;
+    int bestDist = here, behindDist = here;
+    for(int d: field.dirs){
+        int n = start + d;
+        if (!map.floor_at(n)) continue;
+        int nd = field.dist[n];
+        if (blocked(n)) {
+            if (nd < behindDist){ behindDist = nd; behind = n; }
+        } else if (nd < bestDist){ bestDist = nd; best = n; }
+    }
+    int to = bestDist < here ? best : behind;
+    return {map.x_of(to), map.y_of(to)};
+}
+
+// Field of view by recursive shadowcasting: each of the eight octants is scanned row by row
+// outward from the origin, and a wall narrows the window of slopes the rows behind it can see
+// through. Walls never change, so the result depends only on the origin and stays cached until
+// the player moves. Cells are marked with a stamp like BfsScratch, so recomputing clears nothing.
+struct Fov {
+    LevelVec<uint32_t> seen;
+    uint32_t gen = 0;
+    int root = -1, radius = 0;
+
+    void adopt(LevelArena *a){ level_adopt(a, seen); }
+    void reset(const Grid &map){
+        seen.assign(map.size(), 0);
+        gen = 0; root = -1;
+    }
+    void update(const Grid &map, int px, int py, int r){
+        int c = map.idx(px,py);
+        if(c==root && r==radius) return;
+        root = c; radius = r;
+        if(++gen == 0){ fill(seen.begin(), seen.end(), 0); gen = 1; }
+        seen[c] = gen;
+        static const int mult[4][8] = {{1,0,0,-1,-1,0,0,1}, {0,1,-1,0,0,-1,1,0},
+                                       {0,1,1,0,0,-1,-1,0}, {1,0,0,1,-1,0,0,-1}};
+        for(int o=0;o<8;o++) cast(map, px, py, 1, 1.0, 0.0, mult[0][o], mult[1][o], mult[2][o], mult[3][o]);
+    }
+    bool visible(int c) const { return seen[c]==gen; }
+
+private:
+    // rows from `row` outward, seeing through slopes end..start; (xx,xy,yx,yy) maps the octant
+    void cast(const Grid &map, int cx, int cy, int row, double start, double end, int xx, int xy, int yx, int yy){
+        if(start < end) return;
+        double nextStart = start;
+        for(int j=row; j<=radius; j++){
+            bool blocked = false;
+            for(int dx=-j, dy=-j; dx<=0; dx++){
+                double left = (dx-0.5)/(dy+0.5), right = (dx+0.5)/(dy-0.5);
+                if(start < right) continue;
+                if(end > left) break;
+                int x = cx + dx*xx + dy*xy, y = cy + dx*yx + dy*yy;
+                bool inside = map.in_bounds(x,y);
+                bool wall = !inside || !map.floor(x,y);
+                if(inside && dx*dx + dy*dy <= radius*radius) seen[map.idx(x,y)] = gen;
+                if(blocked){
+                    if(wall){ nextStart = right; continue; }
+                    blocked = false;
+                    start = nextStart;
+                } else if(wall && j < radius){
+                    blocked = true;
+                    cast(map, cx, cy, j+1, start, left, xx, xy, yx, yy);
+                    nextStart = right;
+                }
             }
-            break;
+            if(blocked) break;
         }
-        int nx = playerX, ny = playerY;
-        if(ch=='w' || ch=='W') ny--;
-        else if(ch=='s' || ch=='S') ny++;
-        else if(ch=='a' || ch=='A') nx--;
-        else if(ch=='d' || ch=='D') nx++;
-        else {
-            cout << "Unknown input. Use w/a/s/d.\n";
-            continue;
+    }
+};
+
+// Bucket grid over placed rooms, so testing a candidate only looks at rooms near it instead of
+// every room. Buckets are larger than the biggest room, so a room lands in at most 4 of them.
+// Each bucket is an intrusive list (head/next), which keeps the index to three flat arrays.
+struct RoomIndex {
+    static const int BUCKET = 16;
+    int bw=0, bh=0;
+    LevelVec<int> head, next, room;
+
+    void adopt(LevelArena *a){ level_adopt(a, head, next, room); }
+    void reset(const Grid &map, size_t expectedRooms){
+        bw = map.w / BUCKET + 1; bh = map.h / BUCKET + 1;
+        head.assign((size_t)bw * bh, -1);
+        next.clear(); room.clear();
+        next.reserve(expectedRooms * 4); room.reserve(expectedRooms * 4);
+    }
+    template<class F>
+    void for_buckets(const Rect &r, F f) const {
+        int x0 = max(r.x, 0) / BUCKET, x1 = min(r.x + r.w - 1, bw*BUCKET - 1) / BUCKET;
+        int y0 = max(r.y, 0) / BUCKET, y1 = min(r.y + r.h - 1, bh*BUCKET - 1) / BUCKET;
+        for(int by=y0; by<=y1; by++) for(int bx=x0; bx<=x1; bx++) f(by*bw + bx);
+    }
+    void insert(const Rect &r, int id){
+        for_buckets(r, [&](int b){
+            room.push_back(id); next.push_back(head[b]);
+            head[b] = (int)room.size() - 1;
+        });
+    }
+    // the room containing tile (x,y), or -1
+    int find(const LevelVec<Rect> &rooms, int x, int y) const {
+        if(x < 0 || y < 0 || x / BUCKET >= bw || y / BUCKET >= bh) return -1;
+        for(int e = head[(y / BUCKET) * bw + x / BUCKET]; e != -1; e = next[e]){
+            const Rect &r = rooms[room[e]];
+            if(x >= r.x && x < r.x + r.w && y >= r.y && y < r.y + r.h) return room[e];
         }
-        if(nx<0||nx>=MAP_W||ny<0||ny>=MAP_H){
-            cout << "Cannot move out of bounds.\n";
-            continue;
+        return -1;
+    }
+    bool overlaps(const Rect &r, const LevelVec<Rect> &rooms) const {
+        bool hit = false;
+        for_buckets(r, [&](int b){
+            for(int e = head[b]; e != -1 && !hit; e = next[e]) if(r.intersects(rooms[room[e]])) hit = true;
+        });
+        return hit;
+    }
+};
+
+// Abstract graph for long-range pursuit, HPA*-style with rooms as the clusters. Corridor k runs
+// from room k to room k+1 as an L of tiles numbered t = 0..len from room k's centre. Every room
+// it passes through is a stop on it: the t range inside the room, a single interval because the
+// L is monotone in x and y. Consecutive stops of a corridor are joined by an edge weighted by
+// the corridor tiles between them plus a rough cost for crossing the two rooms. Corridors that
+// cross outside rooms are not joined, so routes are valid but not always the shortest.
+// table() runs Dijkstra over rooms toward one goal room and keeps the last two results;
+// next_step() refines only to a tile inside the current room or along the current corridor, so
+// a chase query costs rooms instead of cells. Rebuilt with the map; nothing here is saved.
+struct RoomGraph {
+    static constexpr int UNREACHED = INT_MAX;
+    struct Stop { int corridor, room, tin, tout; };
+    struct Leg { int x0, y0, x1, y1, t0; };  // a straight piece of a corridor, t0 at (x0,y0)
+    struct Table { int goal = -1; LevelVec<int> dist, via; }; // via: edge code toward the goal
+    // Edge code 2*i+d joins stops[i] and stops[i+1] of one corridor: d=0 travels toward
+    // stops[i+1], d=1 back; c^1 reverses c.
+    LevelVec<Leg> legs;                    // corridor k owns legs 2k and 2k+1
+    LevelVec<Stop> stops;                  // corridor k: stops[stopStart[k]..stopStart[k+1]), by tin
+    LevelVec<int> stopStart;
+    LevelVec<int> adjStart, adj;           // edge codes leaving each room
+    RoomIndex index;                       // room lookup by tile
+    LevelVec<int> legStart, legItems;      // legs crossing each RoomIndex bucket
+    Table tables[2];
+    int recent = 0;                        // the table used last
+    LevelVec<pair<int,int>> heap;
+    LevelVec<int> fillAt, seenFor;         // build scratch
+
+    void adopt(LevelArena *a){
+        level_adopt(a, legs, stops, stopStart, adjStart, adj, legStart, legItems, heap, fillAt, seenFor);
+        for(auto &t: tables) level_adopt(a, t.dist, t.via);
+        index.adopt(a);
+    }
+
+    void build(const Grid &map, const LevelVec<Rect> &rooms, const LevelVec<Corridor> &corridors){
+        int nr = (int)rooms.size(), nc = (int)corridors.size();
+        index.reset(map, rooms.size());
+        for(int i=0;i<nr;i++) index.insert(rooms[i], i);
+        legs.clear();
+        for(int k=0;k<nc;k++){
+            int px = rooms[k].centerX(), py = rooms[k].centerY();
+            int cx = corridors[k].cornerX, cy = corridors[k].cornerY;
+            int len0 = abs(cx-px) + abs(cy-py);
+            legs.push_back({px, py, cx, cy, 0});
+            legs.push_back({cx, cy, rooms[k+1].centerX(), rooms[k+1].centerY(), len0});
         }
-        if(map[ny][nx] == '#'){
-            cout << "Bumped into a wall.\n";
-            // count as a turn; enemies still take their turn
-            turns++;
-        } else {
-            // Is there an enemy at destination?
-            int eidx = enemy_index_at(enemies, nx, ny);
-            if(eidx != -1){
-                // attack enemy
-                cout << "You attack the enemy for " << playerAttack << " damage!\n";
-                enemies[eidx].hp -= playerAttack;
-                if(enemies[eidx].hp <= 0){
-                    cout << "Enemy defeated! +10 score.\n";
-                    enemies[eidx].alive = false;
-                    score += 10; // new scoring: +10 per kill
-                    // move player into tile of dead enemy
-                    playerX = nx; playerY = ny;
-                } else {
-                    cout << "Enemy HP left: " << enemies[eidx].hp << "\n";
-                    // player stays in place after attacking
-                }
-                turns++;
-            } else {
-                // Is there an item there?
-                int itidx = item_index_at(items, nx, ny);
-                if(itidx != -1){
-                    int heal = rnd(6,10); // potions heal 6-10
-                    int before = playerHP;
-                    playerHP = min(playerMaxHP, playerHP + heal);
-                    cout << "Picked up a potion! Healed " << (playerHP - before) << " HP (+" << heal << " roll, capped).\n";
-                    // remove item
-                    items.erase(items.begin() + itidx);
+        // legs per bucket, counted first so the lists are one flat array
+        int nb = index.bw * index.bh;
+        legStart.assign(nb + 1, 0);
+        for(auto &l: legs) index.for_buckets(leg_box(l), [&](int b){ legStart[b+1]++; });
+        for(int b=0;b<nb;b++) legStart[b+1] += legStart[b];
+        legItems.resize(legStart[nb]);
+        fillAt.assign(legStart.begin(), legStart.end() - 1);
+        for(int i=0;i<(int)legs.size();i++) index.for_buckets(leg_box(legs[i]), [&](int b){ legItems[fillAt[b]++] = i; });
+
+        // stops: the rooms each corridor's legs pass through
+        stops.clear();
+        stopStart.assign(nc + 1, 0);
+        seenFor.assign(nr, -1);
+        for(int k=0;k<nc;k++){
+            size_t first = stops.size();
+            for(int j=0;j<2;j++) index.for_buckets(leg_box(legs[2*k+j]), [&](int b){
+                for(int e = index.head[b]; e != -1; e = index.next[e]){
+                    int m = index.room[e];
+                    if(seenFor[m]==k) continue;
+                    seenFor[m] = k;
+                    int tin = INT_MAX, tout = INT_MIN;
+                    for(int q=0;q<2;q++) leg_span(legs[2*k+q], rooms[m], tin, tout);
+                    if(tin <= tout) stops.push_back({k, m, tin, tout});
                 }
-                // move player
-                playerX = nx; playerY = ny;
-                turns++;
-            }
+            });
+            sort(stops.begin() + first, stops.end(), [](const Stop &a, const Stop &b){ return a.tin < b.tin; });
+            stopStart[k+1] = (int)stops.size();
         }
 
-        // Enemy turn: each enemy computes a next step via BFS avoiding walls and other enemies.
-        // We must consider simultaneous movement without stacking: we compute intended moves, then resolve.
-        int enemyDamageThisTurn = 0; // track damage inflicted to player (can be multiple enemies)
-        vector<pair<int,int>> occupied; // positions occupied at movement planning (start positions)
-        for(auto &e: enemies) if(e.alive) occupied.emplace_back(e.x,e.y);
-        // We'll build target positions and then validate to avoid collisions; ties resolved by order.
-        vector<pair<int,int>> nextPos(enemies.size());
-        for(size_t i=0;i<enemies.size();++i){
-            if(!enemies[i].alive){ nextPos[i] = {-1,-1}; continue; }
-            // build occupied list for this BFS excluding self
-            vector<pair<int,int>> occ;
-            for(size_t j=0;j<enemies.size();++j) if(j!=i && enemies[j].alive) occ.emplace_back(enemies[j].x, enemies[j].y);
-            pair<int,int> step = bfs_next_step(map, enemies[i].x, enemies[i].y, playerX, playerY, occ);
-            nextPos[i] = step;
-        }
-        // resolve moves in order, forbidding stepping onto tiles that another earlier-moving enemy already took (except player tile).
-        set<pair<int,int>> reserved; // reserved tiles (by earlier moves)
-        for(size_t i=0;i<enemies.size();++i){
-            if(!enemies[i].alive) continue;
-            auto intended = nextPos[i];
-            // if intended is player's tile, attack
-            if(intended.first==playerX && intended.second==playerY){
-                // enemy attacks player
-                int edmg = rnd(diffConfigs[(int)diff].enemyAtkMin, diffConfigs[(int)diff].enemyAtkMax);
-                cout << "An enemy attacks you for " << edmg << " damage!\n";
-                playerHP -= edmg;
-                // enemy doesn't move into player's tile permanently (stays adjacent), but based on earlier spec enemy could step into player tile and attack.
-                // We'll keep enemy at original position if stepping onto player (common roguelike behavior is enemy moves in and attacks; here: remain or move? We'll keep them where they are.)
-                reserved.insert({enemies[i].x, enemies[i].y});
-            } else {
-                // ensure intended tile is not reserved and is floor and not occupied by other alive enemy after resolution
-                bool blocked=false;
-                if(intended.first<0) blocked=true;
-                if(!blocked){
-                    if(map[intended.second][intended.first] != '.') blocked=true;
-                    if(reserved.count(intended)) blocked=true;
-                    // also ensure not stepping onto another alive enemy's current tile unless that enemy is moving away (we check reserved and intended).
-                }
-                if(blocked){
-                    // stay in place
-                    reserved.insert({enemies[i].x, enemies[i].y});
-                } else {
-                    // move enemy
-                    enemies[i].x = intended.first;
-                    enemies[i].y = intended.second;
-                    reserved.insert(intended);
-                }
+        adjStart.assign(nr + 1, 0);
+        for(int k=0;k<nc;k++) for(int i=stopStart[k]; i+1<stopStart[k+1]; i++){
+            adjStart[stops[i].room + 1]++;
+            adjStart[stops[i+1].room + 1]++;
+        }
+        for(int r=0;r<nr;r++) adjStart[r+1] += adjStart[r];
+        adj.resize(adjStart[nr]);
+        fillAt.assign(adjStart.begin(), adjStart.end() - 1);
+        for(int k=0;k<nc;k++) for(int i=stopStart[k]; i+1<stopStart[k+1]; i++){
+            adj[fillAt[stops[i].room]++] = 2*i;
+            adj[fillAt[stops[i+1].room]++] = 2*i + 1;
+        }
+        // sized up front so table() never allocates mid-turn; the lazy heap holds at most one entry per edge
+        for(auto &t: tables){ t.goal = -1; t.dist.reserve(nr); t.via.reserve(nr); }
+        heap.reserve(adj.size() + 1);
+    }
+
+    int room_at(const LevelVec<Rect> &rooms, int x, int y) const { return index.find(rooms, x, y); }
+
+    // tile t of corridor k
+    pair<int,int> point(int k, int t) const {
+        const Leg &l = legs[2*k + (t >= legs[2*k+1].t0)];
+        int d = t - l.t0;
+        return {l.x0 + (l.x1 > l.x0 ? d : l.x1 < l.x0 ? -d : 0), l.y0 + (l.y1 > l.y0 ? d : l.y1 < l.y0 ? -d : 0)};
+    }
+    // f(k, t) for every corridor k through tile (x,y), t being the tile's place on it
+    template<class F>
+    void for_corridors_at(int x, int y, F f) const {
+        if(x < 0 || y < 0 || x / RoomIndex::BUCKET >= index.bw || y / RoomIndex::BUCKET >= index.bh) return;
+        int b = (y / RoomIndex::BUCKET) * index.bw + x / RoomIndex::BUCKET;
+        for(int j=legStart[b]; j<legStart[b+1]; j++){
+            const Leg &l = legs[legItems[j]];
+            if(x < min(l.x0,l.x1) || x > max(l.x0,l.x1) || y < min(l.y0,l.y1) || y > max(l.y0,l.y1)) continue;
+            f(legItems[j] / 2, l.t0 + abs(x - l.x0) + abs(y - l.y0));
+        }
+    }
+
+    // Dijkstra over rooms toward `goal`; either of the last two goals is answered from cache
+    const Table &table(const LevelVec<Rect> &rooms, int goal){
+        for(int i=0;i<2;i++) if(tables[i].goal==goal){ recent = i; return tables[i]; }
+        recent ^= 1;
+        Table &tab = tables[recent];
+        tab.goal = goal;
+        tab.dist.assign(rooms.size(), UNREACHED);
+        tab.via.assign(rooms.size(), -1);
+        heap.clear();
+        tab.dist[goal] = 0;
+        heap.emplace_back(0, goal);
+        while(!heap.empty()){
+            pop_heap(heap.begin(), heap.end(), greater<pair<int,int>>());
+            auto top = heap.back(); heap.pop_back();
+            int u = top.second;
+            if(top.first != tab.dist[u]) continue;
+            for(int j=adjStart[u]; j<adjStart[u+1]; j++){
+                int c = adj[j], v = edge_to(c);
+                int nd = top.first + edge_weight(rooms, c);
+                if(nd >= tab.dist[v]) continue;
+                tab.dist[v] = nd;
+                tab.via[v] = c ^ 1;
+                heap.emplace_back(nd, v);
+                push_heap(heap.begin(), heap.end(), greater<pair<int,int>>());
             }
         }
+        return tab;
+    }
+
+    // The goal (gx,gy) as up to two rooms to reach, each `offset` tiles short of it along corridor
+    // `corridor`. Holds pointers into the table cache, so it is good until the next aim().
+    struct Goal {
+        struct Anchor { int room, offset, exitT; };
+        int x, y, room = -1, corridor = -1, t = 0, count = 0;
+        Anchor anchors[2];
+        const Table *tabs[2];
+    };
+    Goal aim(const LevelVec<Rect> &rooms, int gx, int gy){
+        Goal g;
+        g.x = gx; g.y = gy;
+        g.room = room_at(rooms, gx, gy);
+        if(g.room >= 0) g.anchors[g.count++] = {g.room, 0, 0};
+        else {
+            for_corridors_at(gx, gy, [&](int k, int t){ if(g.corridor < 0){ g.corridor = k; g.t = t; } });
+            if(g.corridor < 0) return g;
+            int after = stop_after(g.corridor, g.t);
+            const Stop &s0 = stops[after-1], &s1 = stops[after];
+            g.anchors[g.count++] = {s0.room, g.t - s0.tout, s0.tout};
+            g.anchors[g.count++] = {s1.room, s1.tin - g.t, s1.tin};
+        }
+        for(int a=0;a<g.count;a++) g.tabs[a] = &table(rooms, g.anchors[a].room);
+        return g;
+    }
 
-        // After enemies moved, check if any enemy occupies player's tile (if they moved into it) -> attack already handled above for intended==player tile.
-        for(auto &e: enemies){
-            if(!e.alive) continue;
-            if(e.x==playerX && e.y==playerY){
-                // If we reach here and player still alive, enemy deals damage (if not already applied)
-                // To avoid double applying, we already applied damage when intended==player tile above; but if an enemy moved onto player in resolution, we attack now as well.
-                // For safety, apply a small fixed damage if player shares tile:
-                int edmg = rnd(diffConfigs[(int)diff].enemyAtkMin, diffConfigs[(int)diff].enemyAtkMax);
-                cout << "An enemy hits you for " << edmg << " damage (bumped into you)!\n";
-                playerHP -= edmg;
+    // One step from (x,y) toward the goal: inside a room toward the tile where the route leaves it,
+    // on a corridor along whichever corridor through the tile is cheapest, which keeps the
+    // estimate falling at crossings. Returns (x,y) when there is no route, or the tile is on neither.
+    pair<int,int> next_step(const LevelVec<Rect> &rooms, const Goal &g, int x, int y){
+        if(g.count == 0) return {x,y};
+        // the cheaper anchor from room r, or -1
+        auto best = [&](int r, int &cost){
+            int pick = -1;
+            cost = UNREACHED;
+            for(int a=0;a<g.count;a++){
+                int d = g.tabs[a]->dist[r];
+                if(d != UNREACHED && d + g.anchors[a].offset < cost){ cost = d + g.anchors[a].offset; pick = a; }
             }
+            return pick;
+        };
+        auto toward = [&](int tx, int ty)->pair<int,int>{
+            int dx = tx - x, dy = ty - y;
+            if(abs(dx) >= abs(dy)) return {x + (dx>0) - (dx<0), y};
+            return {x, y + (dy>0) - (dy<0)};
+        };
+
+        int r = room_at(rooms, x, y), cost;
+        if(r >= 0){
+            if(r == g.room) return toward(g.x, g.y); // a room is open floor
+            int a = best(r, cost);
+            if(a < 0) return {x,y};
+            int k, from, to;
+            if(r == g.anchors[a].room){ k = g.corridor; from = g.anchors[a].exitT; to = g.t; }
+            else { int c = g.tabs[a]->via[r]; k = stops[c >> 1].corridor; from = edge_from_t(c); to = edge_to_t(c); }
+            auto exit = point(k, from);
+            if(exit.first != x || exit.second != y) return toward(exit.first, exit.second);
+            return point(k, from + (to > from ? 1 : -1));
+        }
+        int bestCost = UNREACHED;
+        pair<int,int> step = {x,y};
+        for_corridors_at(x, y, [&](int k, int t){
+            auto consider = [&](int c, int dir){
+                if(c < bestCost){ bestCost = c; step = point(k, t + dir); }
+            };
+            if(k == g.corridor) consider(abs(g.t - t), g.t > t ? 1 : -1);
+            int after = stop_after(k, t);
+            const Stop &s0 = stops[after-1], &s1 = stops[after];
+            if(best(s0.room, cost) >= 0) consider(cost + (t - s0.tout), -1);
+            if(best(s1.room, cost) >= 0) consider(cost + (s1.tin - t), 1);
+        });
+        return step;
+    }
+
+private:
+    static Rect leg_box(const Leg &l){ return Rect{min(l.x0,l.x1), min(l.y0,l.y1), abs(l.x1-l.x0) + 1, abs(l.y1-l.y0) + 1}; }
+    // widens [tin,tout] by the t range where leg l is inside rectangle m
+    static void leg_span(const Leg &l, const Rect &m, int &tin, int &tout){
+        int x0 = max(min(l.x0,l.x1), m.x), x1 = min(max(l.x0,l.x1), m.x + m.w - 1);
+        int y0 = max(min(l.y0,l.y1), m.y), y1 = min(max(l.y0,l.y1), m.y + m.h - 1);
+        if(x0 > x1 || y0 > y1) return;
+        int ta = l.t0 + abs(x0 - l.x0) + abs(y0 - l.y0), tb = l.t0 + abs(x1 - l.x0) + abs(y1 - l.y0);
+        tin = min(tin, min(ta, tb));
+        tout = max(tout, max(ta, tb));
+    }
+    // first stop of corridor k past corridor tile t (which lies outside every room); the
+    // corridor starts and ends inside rooms, so there is always a stop on either side
+    int stop_after(int k, int t) const {
+        return (int)(upper_bound(stops.begin() + stopStart[k], stops.begin() + stopStart[k+1], t,
+                                 [](int v, const Stop &s){ return v < s.tin; }) - stops.begin());
+    }
+    int edge_to(int c) const { return stops[(c >> 1) + !(c & 1)].room; }
+    int edge_from_t(int c) const { return c & 1 ? stops[(c >> 1) + 1].tin : stops[c >> 1].tout; }
+    int edge_to_t(int c) const { return c & 1 ? stops[c >> 1].tout : stops[(c >> 1) + 1].tin; }
+    int edge_weight(const LevelVec<Rect> &rooms, int c) const {
+        const Stop &a = stops[c >> 1], &b = stops[(c >> 1) + 1];
+        const Rect &ra = rooms[a.room], &rb = rooms[b.room];
+        return b.tin - a.tout + (ra.w + ra.h + rb.w + rb.h) / 4;
+    }
+};
+
+// Per-game scratch for the enemy turn, sized once per map so steady-state turns do not allocate.
+// Moves are resolved as one batch on a claim grid: a cell is claimed for the turn when its stamp
+// equals gen, so bumping gen releases every claim at once.
+struct TurnScratch {
+    static constexpr int FREE = -1, STAY = -2, SEARCHED = -3; // ahead[] values that are not an enemy
+    LevelVec<pair<int,int>> nextPos;
+    LevelVec<int> ahead;   // enemy standing on nextPos, FREE if nobody does, STAY if not moving
+    LevelVec<int> behind;  // the enemy whose ahead is this one, or -1
+    enum : uint8_t { ASLEEP, SEES, ROUTES };  // per-enemy planning mode
+    LevelVec<uint8_t> mode;
+    LevelVec<uint32_t> claimed;
+    uint32_t gen = 0;
+
+    void adopt(LevelArena *a){ level_adopt(a, nextPos, ahead, behind, mode, claimed); }
+
+    void reset(const Grid &map, size_t enemies){
+        claimed.assign(map.size(), 0);
+        gen = 0;
+        nextPos.reserve(enemies);
+        ahead.reserve(enemies);
+        behind.reserve(enemies);
+        mode.reserve(enemies);
+    }
+    void begin_turn(size_t enemies){
+        nextPos.resize(enemies);
+        ahead.resize(enemies);
+        behind.assign(enemies, -1);
+        mode.resize(enemies);
+        if(++gen == 0){ fill(claimed.begin(), claimed.end(), 0); gen = 1; }
+    }
+    // false when an earlier enemy got the cell this turn
+    bool claim(int c){
+        if(claimed[c]==gen) return false;
+        claimed[c] = gen;
+        return true;
+    }
+    void plan(int i, int aheadOf){
+        ahead[i] = aheadOf;
+        if(aheadOf >= 0) behind[aheadOf] = i;
+    }
+};
+
+// Carries out every planned move of the turn at once. A claimed cell has one claimant, so each
+// enemy has at most one enemy waiting behind it and the waits form simple lines and rings. A
+// line moves when its front steps onto a FREE tile: the front moves and each enemy behind steps
+// into the tile just vacated, so a queue advances together instead of jamming behind its head.
+// Lines whose front stays (lost claim, attacking, nowhere to go) stay. A ring of three or more,
+// each enemy stepping onto the next one's tile, rotates as a whole; two enemies that want each
+// other's tiles stay, since they would have to pass through each other. Each enemy is visited
+// at most once from its line's front and once more by the ring search, so the pass is linear.
+void resolve_moves(TurnScratch &s, const Grid &map, EnemyList &enemies, Occupancy &occ){
+    int n = (int)s.ahead.size();
+    auto move = [&](int k){
+        // the tile ahead has been vacated already, or is being taken over by a ring; move_enemy
+        // only clears a tile it still owns
+        auto to = s.nextPos[k];
+        occ.move_enemy(map, k, enemies.x[k], enemies.y[k], to.first, to.second);
+        enemies.x[k] = to.first;
+        enemies.y[k] = to.second;
+    };
+    for(int i=0;i<n;++i){
+        if(s.ahead[i]!=TurnScratch::FREE) continue;
+        for(int k=i; k>=0; k=s.behind[k]) move(k);
+    }
+    // What is still waiting on an enemy is the back of a stuck line or a ring. Following ahead
+    // from i comes back to i only around a ring; a line ends at a non-enemy or at a searched one.
+    for(int i=0;i<n;++i){
+        if(s.ahead[i] < 0) continue;
+        int len = 0;
+        bool ring = false;
+        for(int k=i; k>=0; ){
+            int next = s.ahead[k];
+            s.ahead[k] = TurnScratch::SEARCHED;
+            len++;
+            if(next == i){ ring = true; break; }
+            k = next;
         }
+        if(!ring || len < 3) continue;
+        int k = i;
+        do { move(k); k = s.behind[k]; } while(k != i);
+    }
+}
 
-        // small cap
-        if(playerHP > 999) playerHP = 999;
+// Complete state of one game. Everything a turn reads or writes lives here, so the engine can
+// be driven by the interactive loop in main() or headless by a policy (see step()).
+enum Action { ACT_UP=0, ACT_DOWN=1, ACT_LEFT=2, ACT_RIGHT=3, ACT_QUIT=4 };
+
+// Game events: step_as pushes what happened as typed records into the turn's ring instead of
+// formatting text, and step() hands the turn's events to the attached sinks once it is over.
+// With no sink attached an event costs three stores and an increment and flush() returns at
+// once, so headless runs do no formatting at all. Sinks: `text` gets the message lines shown to
+// the player, `binary` gets EventRecords (see EVENT_MAGIC), `counts` tallies them.
+enum EventKind : uint8_t {
+    EV_OUT_OF_BOUNDS,  // move off the map refused
+    EV_WALL,           // bumped into a wall
+    EV_PLAYER_HIT,     // a = damage dealt
+    EV_ENEMY_KILLED,
+    EV_ENEMY_WOUNDED,  // a = hp left
+    EV_POTION,         // a = hp healed, b = roll before the cap
+    EV_ENEMY_ATTACK,   // a = damage taken
+    EV_ENEMY_BUMP,     // a = damage taken from an enemy that ended on the player's tile
+    EV_DESCEND,        // a = new depth
+    EV_COUNT
+};
+struct Event { EventKind kind; int32_t a, b; };
+
+void format_event(ostream &out, const Event &e){
+    switch(e.kind){
+    case EV_OUT_OF_BOUNDS: out << "Cannot move out of bounds.\n"; break;
+    case EV_WALL:          out << "Bumped into a wall.\n"; break;
+    case EV_PLAYER_HIT:    out << "You attack the enemy for " << e.a << " damage!\n"; break;
+    case EV_ENEMY_KILLED:  out << "Enemy defeated! +10 score.\n"; break;
+    case EV_ENEMY_WOUNDED: out << "Enemy HP left: " << e.a << "\n"; break;
+    case EV_POTION:        out << "Picked up a potion! Healed " << e.a << " HP (+" << e.b << " roll, capped).\n"; break;
+    case EV_ENEMY_ATTACK:  out << "An enemy attacks you for " << e.a << " damage!\n"; break;
+    case EV_ENEMY_BUMP:    out << "An enemy hits you for " << e.a << " damage (bumped into you)!\n"; break;
+    case EV_DESCEND:       out << "Floor cleared! You descend to depth " << e.a << ".\n"; break;
+    default: break;
+    }
+}
+
+// Event file: a header, then one record per event in the order they happened.
+const uint32_t EVENT_MAGIC = 0x56454752; // "RGEV"
+const uint32_t EVENT_VERSION = 1;
+struct EventFileHeader { uint32_t magic, version, recordSize, pad; };
+struct EventRecord { int32_t turn; uint8_t kind, pad[3]; int32_t a, b; };
+static_assert(sizeof(EventRecord) == 16, "EventRecord is stored as 4 ints");
+
+struct EventCounts {
+    long long byKind[EV_COUNT] = {};
+    long long damageDealt = 0, damageTaken = 0, healed = 0;
+
+    void add(const Event &e){
+        byKind[e.kind]++;
+        if(e.kind==EV_PLAYER_HIT) damageDealt += e.a;
+        else if(e.kind==EV_ENEMY_ATTACK || e.kind==EV_ENEMY_BUMP) damageTaken += e.a;
+        else if(e.kind==EV_POTION) healed += e.a;
+    }
+    void merge(const EventCounts &o){
+        for(int k=0;k<EV_COUNT;k++) byKind[k] += o.byKind[k];
+        damageDealt += o.damageDealt; damageTaken += o.damageTaken; healed += o.healed;
+    }
+};
+
+struct EventLog {
+    static const int CAPACITY = 64; // a power of two; a turn overflowing it keeps its last CAPACITY events
+    Event ring[CAPACITY];
+    int count = 0;                  // events pushed this turn
+    ostream *text = nullptr;
+    ostream *binary = nullptr;      // opened with write_event_header
+    EventCounts *counts = nullptr;
+
+    void push(EventKind kind, int a = 0, int b = 0){ ring[count++ & (CAPACITY-1)] = {kind, a, b}; }
+    void detach(){ text = binary = nullptr; counts = nullptr; count = 0; }
+    // delivers this turn's events, oldest first, and starts the next turn
+    void flush(int turn){
+        if(count == 0) return;
+        if(text || binary || counts){
+            for(int i = max(0, count - CAPACITY); i < count; i++){
+                const Event &e = ring[i & (CAPACITY-1)];
+                if(text) format_event(*text, e);
+                if(binary){
+                    EventRecord r{turn, (uint8_t)e.kind, {0,0,0}, e.a, e.b};
+                    binary->write((const char*)&r, sizeof r);
+                }
+                if(counts) counts->add(e);
+            }
+        }
+        count = 0;
+    }
+};
+
+void write_event_header(ostream &out){
+    EventFileHeader hd{EVENT_MAGIC, EVENT_VERSION, (uint32_t)sizeof(EventRecord), 0};
+    out.write((const char*)&hd, sizeof hd);
+}
+
+// Everything that belongs to one dungeon floor, including the derived search structures.
+// A floor can be built away from the game (see LevelPipeline) and swapped in, which only
+// moves buffers.
+struct LevelState {
+    unique_ptr<LevelArena> arena; // every buffer below allocates from it once begin_level() ran
+    int depth = 1;
+    Grid map;
+    LevelVec<Rect> rooms;
+    LevelVec<Corridor> corridors; // corridors[i] joins rooms[i] and rooms[i+1]
+    EnemyList enemies;
+    LevelVec<Item> items;
+    FloorList floors;      // free floor tiles, built with the map
+    Components comps;      // connected regions of the floor
+    int startX=1, startY=1; // player spawn
+    DistanceField field;   // rooted at the player, reused every enemy turn
+    RoomGraph graph;       // long-range routes over rooms and corridors
+    Fov fov;               // what the player sees, for waking enemies
+    Occupancy occ;
+    TurnScratch scratch;
+
+    // Drops every buffer of the current floor and releases the arena, so the next floor is
+    // built from the start of its memory. Callers fill everything in afterwards.
+    void begin_level(){
+        if(!arena) arena.reset(new LevelArena);
+        LevelArena *a = arena.get();
+        level_adopt(a, rooms, corridors, items);
+        map.adopt(a); enemies.adopt(a); floors.adopt(a); comps.adopt(a); field.adopt(a);
+        graph.adopt(a); fov.adopt(a); occ.adopt(a); scratch.adopt(a);
+        a->release();
+    }
+};
+
+struct LevelPipeline;
+struct ChunkWorld;
+
+struct Game : LevelState {
+    Difficulty diff = NORMAL;
+    DiffConfig config = diffConfigs[NORMAL]; // diffConfigs[diff] unless loaded from a config file
+    uint64_t seed = 0;     // every floor's layout is derived from this and its depth
+    int playerX=1, playerY=1;
+    int playerHP=20, playerMaxHP=20, playerAttack=4, enemyAttackDamage=2, potionHeal=8;
+    int score=0, turns=0;
+    bool quit=false;
+    int floorLimit = 0;    // clearing a floor descends until this depth; 0 = no limit
+    LevelPipeline *pipeline = nullptr; // prepared floors; null builds the next floor on demand
+    ChunkWorld *world = nullptr; // --explore: one endless floor streamed in chunks instead of levels
+    EventLog events;       // combat and pickup events of the current turn; no sinks when headless
+    Rng rng;
+
+    bool over() const { return quit || playerHP <= 0; }
+    bool cleared() const { return !world && enemies.empty(); } // an endless world never is
+    bool can_descend() const { return floorLimit==0 || depth < floorLimit; }
+};
+
+// Render & UI
+const char *const HEADER_LINES[] = {
+    "=== Tiny Roguelike ===",
+    "Controls: w=up a=left s=down d=right    p=save    q=quit",
+    "Objective: survive, kill enemies (score +10 per kill), pick potions '!' to heal.",
+    "Clear a floor of enemies to descend to the next one.",
+    "High score saved in highscore.txt",
+};
+const char *const MOVE_PROMPT = "Enter move (w/a/s/d), p to save or q to quit: ";
+
+void print_header(){
+    for(auto line: HEADER_LINES) cout << line << '\n';
+    cout << '\n';
+}
+
+string status_line(const Game &g, int highScore){
+    string diffName = (g.diff==EASY?"Easy":(g.diff==NORMAL?"Normal":"Hard"));
+    return "Diff: " + diffName + "    Depth: " + to_string(g.depth) + "    HP: " + to_string(g.playerHP) + "/" + to_string(g.playerMaxHP)
+         + "    Score: " + to_string(g.score) + "    Turns: " + to_string(g.turns) + "    High: " + to_string(highScore);
+}
+
+// Glyph of every map cell, row-major w*h, with items, enemies and the player drawn on top.
+void build_frame(const Game &g, vector<char> &frame){
+    const Grid &map = g.map;
+    frame.resize((size_t)map.w * map.h);
+    for(int y=0;y<map.h;y++) for(int x=0;x<map.w;x++) frame[(size_t)y*map.w + x] = map.glyph(x,y);
+    for(auto &it: g.items) if (it.x>=0 && it.y>=0) frame[(size_t)it.y*map.w + it.x] = '!';
+    const EnemyList &en = g.enemies;
+    for(size_t i=0;i<en.size();++i) frame[(size_t)en.y[i]*map.w + en.x[i]] = 'E';
+    if (g.playerX>=0 && g.playerY>=0) frame[(size_t)g.playerY*map.w + g.playerX] = '@';
+}
+
+// Full redraw as plain text; used when stdout is not a terminal.
+void render(const Game &g, int highScore) {
+    print_header();
+    cout << status_line(g, highScore) << "\n\n";
+    vector<char> frame;
+    build_frame(g, frame);
+    // one text row per map row plus its newline
+    string draw;
+    draw.reserve(frame.size() + g.map.h);
+    for(int y=0;y<g.map.h;y++){ draw.append(&frame[(size_t)y*g.map.w], g.map.w); draw += '\n'; }
+    cout << draw << '\n';
+}
+
+// Calls f(x, y, len) for every run of cells on one row that differs between two w*h frames;
+// with no old frame every row is one run.
+template<class F>
+void for_each_changed_run(const char *old, const char *cur, int w, int h, F f){
+    for(int y=0;y<h;y++){
+        const char *row = cur + (size_t)y*w;
+        const char *was = old ? old + (size_t)y*w : nullptr;
+        int x = 0;
+        while(x < w){
+            if(was && row[x]==was[x]){ x++; continue; }
+            int run = x;
+            while(run < w && (!was || row[run]!=was[run])) run++;
+            f(x, y, run - x);
+            x = run;
+        }
+    }
+}
+
+// Terminal renderer that keeps the previous frame and only sends what changed: map cells are
+// addressed with ANSI cursor positioning, runs of adjacent changes share one jump, and the whole
+// frame goes out in a single write(). Layout: header, status line, map, message lines, prompt.
+struct TermRenderer {
+    vector<char> prev, cur;
+    string prevStatus;
+    string out;   // frame being assembled, reused between frames
+    bool full = true;
+
+    static const int STATUS_ROW = 7; // after the header and a blank line
+    static const int MAP_ROW = 9;
+
+    void move_to(int row, int col){ out += "\x1b[" + to_string(row) + ";" + to_string(col) + "H"; }
+
+    // messages: text logged during the last turn, one per line
+    void draw(const Game &g, int highScore, const string &messages, bool prompt){
+        const Grid &map = g.map;
+        out.clear();
+        build_frame(g, cur);
+        if(prev.size() != cur.size()) full = true;
+        if(full){
+            out += "\x1b[2J\x1b[H";
+            for(auto line: HEADER_LINES){ out += line; out += "\r\n"; }
+            prevStatus.clear();
+        }
+        string status = status_line(g, highScore);
+        if(status != prevStatus){
+            move_to(STATUS_ROW, 1);
+            out += status;
+            out += "\x1b[K";
+            prevStatus = status;
+        }
+        for_each_changed_run(full ? nullptr : prev.data(), cur.data(), map.w, map.h, [&](int x, int y, int len){
+            move_to(MAP_ROW + y, x + 1);
+            out.append(&cur[(size_t)y*map.w + x], len);
+        });
+        // messages and prompt go below the map; clear whatever the last frame left there
+        move_to(MAP_ROW + map.h + 1, 1);
+        out += "\x1b[J";
+        size_t start = 0;
+        while(start < messages.size()){
+            size_t end = messages.find('\n', start);
+            if(end==string::npos) end = messages.size();
+            out.append(messages, start, end - start);
+            out += "\r\n";
+            start = end + 1;
+        }
+        if(prompt) out += MOVE_PROMPT;
+        swap(prev, cur);
+        full = false;
+        write_all(out);
+    }
+
+    static void write_all(const string &data){
+        cout.flush();
+        size_t done = 0;
+        while(done < data.size()){
+            ssize_t n = ::write(STDOUT_FILENO, data.data() + done, data.size() - done);
+            if(n <= 0){ if(n < 0 && errno==EINTR) continue; break; }
+            done += (size_t)n;
+        }
+    }
+};
+
+// High scores: a leaderboard of the best K results in highscore.txt, one
+// "score turns depth diff seed" line each, best first, so the file still starts with the high
+// score. Finishing a game only pushes its result onto a lock-free list; flush() drains whatever
+// has piled up as one batch and appends it to this process's segment log
+// (highscore.txt.seg.<pid>, one write per batch) under a shared flock on highscore.txt.lock.
+// Compaction takes that lock exclusively, merges the table with the segments, drops entries
+// that are the same result (a compaction killed before its unlinks leaves segments that are
+// merged again), writes and fsyncs a temp file, renames it over the table and fsyncs the
+// directory, then deletes the merged segments. Segments of other live processes are left to
+// their owners, so processes finishing games together never lose a result; a segment left
+// behind by a dead process is merged by whoever compacts next. Since appends hold the lock
+// too, a new process that reuses a dead one's pid cannot append between a compaction's read
+// of that segment and its unlink.
+struct ScoreEntry { int score=0, turns=0, depth=1, diff=NORMAL; uint64_t seed=0; };
+ScoreEntry score_entry(const Game &g){ return {g.score, g.turns, g.depth, (int)g.diff, g.seed}; }
+
+struct Leaderboard {
+    string path;
+    size_t topK;
+    int compactEvery = 256; // results appended to our segment before compacting on our own
+
+    explicit Leaderboard(const string &file, size_t k = 10) : path(file), topK(k) { table = read_entries(path); }
+    ~Leaderboard(){ flush(true); }
+    Leaderboard(const Leaderboard&) = delete;
+    Leaderboard &operator=(const Leaderboard&) = delete;
+
+    // safe from any thread; never blocks or does I/O
+    void submit(const ScoreEntry &e){
+        Node *n = new Node{e, pending.load(memory_order_relaxed)};
+        while(!pending.compare_exchange_weak(n->next, n, memory_order_release, memory_order_relaxed)) {}
+        queued.fetch_add(1, memory_order_relaxed);
+    }
+    // flushes once `batch` results are waiting, unless another thread is flushing already
+    void maybe_flush(int batch){
+        if(queued.load(memory_order_relaxed) < batch) return;
+        unique_lock<mutex> lk(io, try_to_lock);
+        if(lk.owns_lock()) flush_locked(false);
+    }
+    bool flush(bool compact){ lock_guard<mutex> lk(io); return flush_locked(compact); }
+    int best(){ lock_guard<mutex> lk(io); return table.empty() ? 0 : table[0].score; }
+
+private:
+    struct Node { ScoreEntry e; Node *next; };
+    atomic<Node*> pending{nullptr};
+    atomic<int> queued{0};
+    mutex io;                   // one drain or compaction at a time within this process
+    vector<ScoreEntry> table;   // the table as last read or written
+    int unmerged = 0;           // results in our segment that are not in the table yet
+    vector<ScoreEntry> merged;  // compaction scratch
+
+    string segment_prefix() const {
+        size_t slash = path.find_last_of('/');
+        return (slash == string::npos ? path : path.substr(slash + 1)) + ".seg.";
+    }
+    string directory() const {
+        size_t slash = path.find_last_of('/');
+        return slash == string::npos ? "./" : path.substr(0, slash + 1);
+    }
+    // flock on the lock file, shared for segment appends and exclusive for compaction;
+    // returns the descriptor to pass to unlock(), or -1
+    int lock(int op) const {
+        int fd = ::open((path + ".lock").c_str(), O_RDWR | O_CREAT, 0644);
+        if(fd >= 0 && flock(fd, op) != 0){ close(fd); fd = -1; }
+        return fd;
+    }
+    static void unlock(int fd){
+        flock(fd, LOCK_UN);
+        close(fd);
+    }
+
+    static vector<ScoreEntry> read_entries(const string &file){
+        vector<ScoreEntry> out;
+        ifstream ifs(file);
+        string line;
+        while(getline(ifs, line)){
+            ScoreEntry e;
+            unsigned long long seed = 0;
+            // a bare number is a high score file from before the leaderboard
+            if(sscanf(line.c_str(), "%d %d %d %d %llu", &e.score, &e.turns, &e.depth, &e.diff, &seed) < 1) continue;
+            e.seed = seed;
+            out.push_back(e);
+        }
+        return out;
+    }
+    static void format(string &out, const ScoreEntry &e){
+        char buf[96];
+        snprintf(buf, sizeof buf, "%d %d %d %d %llu\n", e.score, e.turns, e.depth, e.diff, (unsigned long long)e.seed);
+        out += buf;
+    }
+
+    bool flush_locked(bool compact){
+        Node *list = pending.exchange(nullptr, memory_order_acquire);
+        string batch;
+        int count = 0;
+        while(list){
+            format(batch, list->e);
+            Node *next = list->next;
+            delete list;
+            list = next;
+            count++;
+        }
+        queued.fetch_sub(count, memory_order_relaxed);
+        if(count){
+            string seg = directory() + segment_prefix() + to_string(getpid());
+            int lockFd = lock(LOCK_SH);
+            int fd = lockFd < 0 ? -1 : ::open(seg.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+            bool ok = fd >= 0 && write(fd, batch.data(), batch.size()) == (ssize_t)batch.size();
+            if(fd >= 0) close(fd);
+            if(lockFd >= 0) unlock(lockFd);
+            if(!ok){ cerr << "Warning: could not write high score\n"; return false; }
+            unmerged += count;
+        }
+        if(!(compact ? unmerged > 0 : unmerged >= compactEvery)) return true;
+        return compact_locked();
+    }
+
+    bool compact_locked(){
+        int lockFd = lock(LOCK_EX);
+        if(lockFd < 0){
+            cerr << "Warning: could not write high score\n";
+            return false;
+        }
+        merged = read_entries(path);
+        vector<string> segments;
+        string dir = directory(), prefix = segment_prefix();
+        if(DIR *d = opendir(dir.c_str())){
+            while(dirent *ent = readdir(d)){
+                string name = ent->d_name;
+                if(name.compare(0, prefix.size(), prefix) != 0) continue;
+                int pid = atoi(name.c_str() + prefix.size());
+                if(pid <= 0 || (pid != getpid() && !(kill(pid, 0) != 0 && errno == ESRCH))) continue;
+                segments.push_back(dir + name);
+                auto more = read_entries(segments.back());
+                merged.insert(merged.end(), more.begin(), more.end());
+            }
+            closedir(d);
+        }
+        // best first; the rest of the key only puts copies of one result next to each other
+        auto key = [](const ScoreEntry &e){ return make_tuple(-e.score, e.turns, e.depth, e.diff, e.seed); };
+        sort(merged.begin(), merged.end(), [&](const ScoreEntry &a, const ScoreEntry &b){ return key(a) < key(b); });
+        merged.erase(unique(merged.begin(), merged.end(), [&](const ScoreEntry &a, const ScoreEntry &b){
+            return key(a) == key(b);
+        }), merged.end());
+        if(merged.size() > topK) merged.resize(topK);
+        string text;
+        for(auto &e: merged) format(text, e);
+        // the table must be on disk before the rename publishes it and the rename before the
+        // segments go, or a crash could lose results that were already merged
+        string tmp = path + ".tmp." + to_string(getpid());
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool ok = fd >= 0 && write(fd, text.data(), text.size()) == (ssize_t)text.size() && fsync(fd) == 0;
+        if(fd >= 0) close(fd);
+        ok = ok && rename(tmp.c_str(), path.c_str()) == 0;
+        if(ok){
+            int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+            ok = dirFd >= 0 && fsync(dirFd) == 0;
+            if(dirFd >= 0) close(dirFd);
+        }
+        if(ok){
+            for(auto &s: segments) unlink(s.c_str());
+            table.swap(merged);
+            unmerged = 0;
+        } else {
+            unlink(tmp.c_str());
+            cerr << "Warning: could not write high score\n";
+        }
+        unlock(lockFd);
+        return ok;
+    }
+};
+
+// Save files: a flat image of one Game in native byte order (little-endian on everything we
+// build for). A fixed header lists the player state, the RNG and where each array section
+// starts; sections are 8-byte aligned, so a mapped file is used in place: SnapshotView only
+// checks the header and bounds, and restoring copies the arrays straight into the game.
+// Derived structures (distance field, room graph, occupancy, turn scratch) are rebuilt, not stored.
+// Bump SNAP_VERSION whenever the layout changes.
+const uint32_t SNAP_MAGIC = 0x56534752; // "RGSV"
+const uint32_t SNAP_VERSION = 3;
+
+struct SnapHeader {
+    uint32_t magic, version;
+    uint64_t fileSize;
+    uint64_t seed, rngState, rngInc;
+    int32_t w, h, diff, depth, floorLimit;
+    int32_t playerX, playerY, playerHP, playerMaxHP, playerAttack, enemyAttackDamage, potionHeal;
+    int32_t score, turns, startX, startY;
+    int32_t roomCount, enemyCount, itemCount, floorCount, floorsTaken, corridorCount;
+    DiffConfig config;
+    uint64_t cellsOff, roomsOff, enemyXOff, enemyYOff, enemyHpOff, itemsOff, floorsOff, corridorsOff;
+};
+static_assert(is_trivially_copyable<Rect>::value && sizeof(Rect)==16, "Rect is stored as 4 ints");
+static_assert(is_trivially_copyable<Item>::value && sizeof(Item)==8, "Item is stored as 2 ints");
+static_assert(is_trivially_copyable<Corridor>::value && sizeof(Corridor)==8, "Corridor is stored as 2 ints");
+
+// Serialises g into out (resized to the file size; its capacity is reused between calls).
+void write_snapshot(const Game &g, vector<uint8_t> &out){
+    SnapHeader hd;
+    memset(&hd, 0, sizeof hd);
+    hd.magic = SNAP_MAGIC; hd.version = SNAP_VERSION;
+    hd.seed = g.seed; hd.rngState = g.rng.state; hd.rngInc = g.rng.inc;
+    hd.w = g.map.w; hd.h = g.map.h; hd.diff = (int)g.diff; hd.depth = g.depth; hd.floorLimit = g.floorLimit;
+    hd.config = g.config;
+    hd.playerX = g.playerX; hd.playerY = g.playerY; hd.playerHP = g.playerHP; hd.playerMaxHP = g.playerMaxHP;
+    hd.playerAttack = g.playerAttack; hd.enemyAttackDamage = g.enemyAttackDamage; hd.potionHeal = g.potionHeal;
+    hd.score = g.score; hd.turns = g.turns; hd.startX = g.startX; hd.startY = g.startY;
+    hd.roomCount = (int32_t)g.rooms.size(); hd.enemyCount = (int32_t)g.enemies.size();
+    hd.itemCount = (int32_t)g.items.size(); hd.floorCount = (int32_t)g.floors.cells.size();
+    hd.floorsTaken = g.floors.taken; hd.corridorCount = (int32_t)g.corridors.size();
+
+    uint64_t at = sizeof(SnapHeader);
+    auto place = [&](uint64_t bytes){ uint64_t off = at; at = (at + bytes + 7) & ~7ull; return off; };
+    hd.cellsOff = place(g.map.cells.size());
+    hd.roomsOff = place(g.rooms.size() * sizeof(Rect));
+    hd.enemyXOff = place(g.enemies.size() * sizeof(int32_t));
+    hd.enemyYOff = place(g.enemies.size() * sizeof(int32_t));
+    hd.enemyHpOff = place(g.enemies.size() * sizeof(int32_t));
+    hd.itemsOff = place(g.items.size() * sizeof(Item));
+    hd.floorsOff = place(g.floors.cells.size() * sizeof(int32_t));
+    hd.corridorsOff = place(g.corridors.size() * sizeof(Corridor));
+    hd.fileSize = at;
+
+    out.assign(at, 0);
+    uint8_t *p = out.data();
+    auto put = [&](uint64_t off, const void *src, size_t bytes){ if(bytes) memcpy(p + off, src, bytes); };
+    put(0, &hd, sizeof hd);
+    put(hd.cellsOff, g.map.cells.data(), g.map.cells.size());
+    put(hd.roomsOff, g.rooms.data(), g.rooms.size() * sizeof(Rect));
+    put(hd.enemyXOff, g.enemies.x.data(), g.enemies.size() * sizeof(int32_t));
+    put(hd.enemyYOff, g.enemies.y.data(), g.enemies.size() * sizeof(int32_t));
+    put(hd.enemyHpOff, g.enemies.hp.data(), g.enemies.size() * sizeof(int32_t));
+    put(hd.itemsOff, g.items.data(), g.items.size() * sizeof(Item));
+    put(hd.floorsOff, g.floors.cells.data(), g.floors.cells.size() * sizeof(int32_t));
+    put(hd.corridorsOff, g.corridors.data(), g.corridors.size() * sizeof(Corridor));
+}
+
+// Read-only view of a snapshot held in memory (a mapped file or a write_snapshot buffer).
+// open() validates the header and that every section lies inside the data; after that the
+// accessors point straight into it.
+struct SnapshotView {
+    const uint8_t *base = nullptr;
+    const SnapHeader *hd = nullptr;
+
+    bool open(const void *data, size_t size){
+        base = (const uint8_t*)data; hd = nullptr;
+        if(size < sizeof(SnapHeader) || ((uintptr_t)data & 7)) return false;
+        const SnapHeader *h = (const SnapHeader*)base;
+        if(h->magic != SNAP_MAGIC || h->version != SNAP_VERSION || h->fileSize > size) return false;
+        if(h->w < MIN_MAP_W || h->h < MIN_MAP_H || h->w > 1<<15 || h->h > 1<<15 || h->diff < 0 || h->diff > 2) return false;
+        if(h->roomCount < 0 || h->enemyCount < 0 || h->itemCount < 0 || h->floorCount < 0) return false;
+        if(h->corridorCount != max(h->roomCount - 1, 0)) return false;
+        if(h->floorsTaken < 0 || h->floorsTaken > h->floorCount) return false;
+        uint64_t cells = (uint64_t)(h->w + 2) * (h->h + 2);
+        auto fits = [&](uint64_t off, uint64_t bytes){ return off % 8 == 0 && off <= h->fileSize && bytes <= h->fileSize - off; };
+        if(!fits(h->cellsOff, cells) || !fits(h->roomsOff, (uint64_t)h->roomCount * sizeof(Rect)) ||
+           !fits(h->enemyXOff, (uint64_t)h->enemyCount * 4) || !fits(h->enemyYOff, (uint64_t)h->enemyCount * 4) ||
+           !fits(h->enemyHpOff, (uint64_t)h->enemyCount * 4) || !fits(h->itemsOff, (uint64_t)h->itemCount * sizeof(Item)) ||
+           !fits(h->floorsOff, (uint64_t)h->floorCount * 4) ||
+           !fits(h->corridorsOff, (uint64_t)h->corridorCount * sizeof(Corridor))) return false;
+        hd = h;
+        return true;
+    }
+    const uint8_t *cells() const { return base + hd->cellsOff; }
+    const Rect *rooms() const { return (const Rect*)(base + hd->roomsOff); }
+    const int32_t *enemy_x() const { return (const int32_t*)(base + hd->enemyXOff); }
+    const int32_t *enemy_y() const { return (const int32_t*)(base + hd->enemyYOff); }
+    const int32_t *enemy_hp() const { return (const int32_t*)(base + hd->enemyHpOff); }
+    const Item *items() const { return (const Item*)(base + hd->itemsOff); }
+    const int32_t *floors() const { return (const int32_t*)(base + hd->floorsOff); }
+    const Corridor *corridors() const { return (const Corridor*)(base + hd->corridorsOff); }
+};
+
+// A whole file mapped read-only; empty (data==nullptr) if it could not be opened.
+struct MappedFile {
+    void *data = nullptr;
+    size_t size = 0;
+
+    explicit MappedFile(const string &path){
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) return;
+        struct stat st;
+        if(fstat(fd, &st)==0 && st.st_size > 0){
+            void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(p != MAP_FAILED){ data = p; size = (size_t)st.st_size; }
+        }
+        close(fd);
+    }
+    ~MappedFile(){ if(data) munmap(data, size); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile &operator=(const MappedFile&) = delete;
+};
+
+// Replaces g's state with the snapshot's. Positions are checked against the map, so a damaged
+// file is rejected instead of indexing out of bounds or corrupting the occupancy layers: the
+// border must be wall, the player, enemies and items must stand on floor, and no two enemies or
+// two items may share a tile, nor either with the player. The free-floor list must hold floor
+// cells, and depth, the player's and every enemy's HP and the config must be values a game can
+// reach. g is unchanged on failure.
+bool restore_snapshot(Game &g, const SnapshotView &v){
+    const SnapHeader &hd = *v.hd;
+    if(hd.depth < 1 || hd.playerHP < 1 || !valid_config(hd.config)) return false;
+    int stride = hd.w + 2, cellCount = stride * (hd.h + 2);
+    const uint8_t *cells = v.cells();
+    for(int x=0;x<stride;x++) if((cells[x] | cells[cellCount - stride + x]) & CELL_FLOOR) return false;
+    for(int y=1;y<=hd.h;y++) if((cells[y*stride] | cells[y*stride + stride-1]) & CELL_FLOOR) return false;
+    auto inside = [&](int x, int y){ return x>=0 && x<hd.w && y>=0 && y<hd.h; };
+    auto on_floor = [&](int x, int y){ return inside(x, y) && (cells[(y+1)*stride + x+1] & CELL_FLOOR); };
+    if(!on_floor(hd.playerX, hd.playerY) || !on_floor(hd.startX, hd.startY)) return false;
+    // bit 0: an enemy stands here, bit 1: an item lies here; the player's tile counts as both
+    static thread_local vector<uint8_t> taken; // keeps its buffer between loads
+    taken.assign(cellCount, 0);
+    taken[(hd.playerY+1)*stride + hd.playerX+1] = 3;
+    for(int i=0;i<hd.enemyCount;i++){
+        int x = v.enemy_x()[i], y = v.enemy_y()[i];
+        if(!on_floor(x, y) || v.enemy_hp()[i] < 1) return false;
+        uint8_t &t = taken[(y+1)*stride + x+1];
+        if(t & 1) return false;
+        t |= 1;
+    }
+    for(int i=0;i<hd.itemCount;i++){
+        int x = v.items()[i].x, y = v.items()[i].y;
+        if(!on_floor(x, y)) return false;
+        uint8_t &t = taken[(y+1)*stride + x+1];
+        if(t & 2) return false;
+        t |= 2;
+    }
+    for(int i=0;i<hd.floorCount;i++){
+        int c = v.floors()[i];
+        if(c < 0 || c >= cellCount || !(cells[c] & CELL_FLOOR)) return false;
+    }
+    // the room graph walks corridors between room centres, so those must be on the map
+    for(int i=0;i<hd.roomCount;i++){
+        const Rect &r = v.rooms()[i];
+        if(r.w < 1 || r.h < 1 || !inside(r.x, r.y) || !inside(r.x + r.w - 1, r.y + r.h - 1)) return false;
+    }
+    for(int i=0;i<hd.corridorCount;i++){
+        const Rect &a = v.rooms()[i], &b = v.rooms()[i+1];
+        Corridor c = v.corridors()[i];
+        bool hFirst = c.cornerX==b.centerX() && c.cornerY==a.centerY();
+        bool vFirst = c.cornerX==a.centerX() && c.cornerY==b.centerY();
+        if(!hFirst && !vFirst) return false;
+    }
+
+    g.diff = (Difficulty)hd.diff; g.config = hd.config; g.seed = hd.seed; g.depth = hd.depth; g.floorLimit = hd.floorLimit;
+    g.rng.state = hd.rngState; g.rng.inc = hd.rngInc;
+    g.begin_level();
+    g.map.resize(hd.w, hd.h);
+    memcpy(g.map.cells.data(), v.cells(), g.map.cells.size());
+    g.rooms.assign(v.rooms(), v.rooms() + hd.roomCount);
+    g.corridors.assign(v.corridors(), v.corridors() + hd.corridorCount);
+    g.enemies.x.assign(v.enemy_x(), v.enemy_x() + hd.enemyCount);
+    g.enemies.y.assign(v.enemy_y(), v.enemy_y() + hd.enemyCount);
+    g.enemies.hp.assign(v.enemy_hp(), v.enemy_hp() + hd.enemyCount);
+    g.items.assign(v.items(), v.items() + hd.itemCount);
+    g.floors.cells.assign(v.floors(), v.floors() + hd.floorCount);
+    g.floors.taken = hd.floorsTaken;
+    g.startX = hd.startX; g.startY = hd.startY;
+    g.playerX = hd.playerX; g.playerY = hd.playerY;
+    g.playerHP = hd.playerHP; g.playerMaxHP = hd.playerMaxHP; g.playerAttack = hd.playerAttack;
+    g.enemyAttackDamage = hd.enemyAttackDamage; g.potionHeal = hd.potionHeal;
+    g.score = hd.score; g.turns = hd.turns; g.quit = false;
+    g.field.reset(g.map, g.playerX, g.playerY);
+    g.graph.build(g.map, g.rooms, g.corridors);
+    label_components(g.comps, g.map, g.playerX, g.playerY);
+    g.fov.reset(g.map);
+    g.occ.reset(g.map, g.enemies, g.items);
+    g.scratch.reset(g.map, g.enemies.size());
+    return true;
+}
+
+// Writes next to path and renames over it, so an interrupted save never leaves a torn file.
+bool save_snapshot(const Game &g, const string &path){
+    vector<uint8_t> buf;
+    write_snapshot(g, buf);
+    string tmp = path + ".tmp";
+    {
+        ofstream ofs(tmp, ios::binary | ios::trunc);
+        if(!ofs.write((const char*)buf.data(), (streamsize)buf.size())) return false;
+    }
+    return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+// Loads a snapshot file through a read-only mapping.
+bool load_snapshot(Game &g, const string &path){
+    MappedFile file(path);
+    SnapshotView view;
+    return file.data && view.open(file.data, file.size) && restore_snapshot(g, view);
+}
+
+// Room count range for a map: 3-6 rooms on the default 20x10 map, otherwise scaled with area.
+pair<int,int> room_count_range(const Grid &map){
+    int maxRooms = max(6, map.w * map.h / 256);
+    return {max(3, maxRooms/2), maxRooms};
+}
+
+// Global-ish: we will group generation code into regenerate_map
+// Rejected placements are retried out of one budget of 20 attempts per requested room, shared
+// by the whole map, so generation always terminates; a crowded map simply ends up with fewer
+// rooms. Overlap tests go through a RoomIndex, so they only look at rooms in nearby buckets.
+void generate_map_basic(Grid &map, LevelVec<Rect> &rooms, Rng &rng, LevelVec<Corridor> *corridors = nullptr) {
+    create_empty_map(map);
+    rooms.clear();
+    if(corridors) corridors->clear();
+    auto range = room_count_range(map);
+    int roomCount = rnd(rng, range.first, range.second);
+    const int maxAttempts = roomCount * 20;
+    static thread_local RoomIndex index; // keeps its buffers between levels
+    index.reset(map, roomCount);
+    rooms.reserve(roomCount);
+    for(int attempt=0; (int)rooms.size()<roomCount && attempt<maxAttempts; attempt++){
+        Rect r;
+        r.w = rnd(rng, 3,8);
+        r.h = rnd(rng, 3,5);
+        r.x = rnd(rng, 1, map.w - r.w - 1);
+        r.y = rnd(rng, 1, map.h - r.h - 1);
+        if(index.overlaps(r, rooms)) continue;
+        carve_room(map, r);
+        if(!rooms.empty()){
+            int px = rooms.back().centerX(), py = rooms.back().centerY();
+            int cx = r.centerX(), cy = r.centerY();
+            bool hFirst = rnd(rng, 0,1)==0;
+            if (hFirst){
+                carve_h(map, px, cx, py);
+                carve_v(map, py, cy, cx);
+            } else {
+                carve_v(map, py, cy, px);
+                carve_h(map, px, cx, cy);
+            }
+            if(corridors) corridors->push_back(hFirst ? Corridor{cx, py} : Corridor{px, cy});
+        }
+        index.insert(r, (int)rooms.size());
+        rooms.push_back(r);
+    }
+    // fallback to open floor if none (the first candidate always fits, so this is only a guard)
+    if(rooms.empty()) carve_room(map, Rect{1, 1, map.w-2, map.h-2});
+}
+
+// Enemies and potions for one floor (or one chunk of an endless world) according to difficulty.
+// Both are drawn from `floors` without replacement, so they never share a tile with each other
+// or with anything excluded beforehand, like the player's spawn.
+void place_population(const Grid &map, FloorList &floors, Rng &rng, const DiffConfig &cfg, EnemyList &enemies, LevelVec<Item> &items){
+    enemies.clear();
+    int ecount = rnd(rng, cfg.enemyMin, cfg.enemyMax);
+    for(int i=0;i<ecount;i++){
+        int c = floors.sample(rng);
+        if(c < 0) break; // map smaller than the population
+        enemies.push(map.x_of(c), map.y_of(c), rnd(rng, cfg.enemyHpMin, cfg.enemyHpMax));
+    }
+
+    // items (potions)
+    items.clear();
+    int pcount = rnd(rng, cfg.potionMin, cfg.potionMax);
+    for(int i=0;i<pcount;i++){
+        int c = floors.sample(rng);
+        if(c < 0) break;
+        items.push_back({map.x_of(c), map.y_of(c)});
+    }
+}
+
+// Seed of one floor: depends only on the game seed and the depth, so a floor comes out the same
+// whether it was prepared in the background or built on demand.
+uint64_t level_seed(uint64_t gameSeed, int depth){ return mix_seed(gameSeed ^ mix_seed(0x1E7E1ull + (uint64_t)depth)); }
+
+// generate_level: builds one floor and places the player spawn, enemies and items according to
+// difficulty. Uses its own generator, never the game's, so it can run on any thread.
+void generate_level(LevelState &lvl, const DiffConfig &cfg, int mapW, int mapH, uint64_t gameSeed, int depth){
+    lvl.begin_level();
+    lvl.depth = depth;
+    Grid &map = lvl.map;
+    map.resize(mapW, mapH);
+    Rng rng(level_seed(gameSeed, depth));
+    // generate map
+    generate_map_basic(map, lvl.rooms, rng, &lvl.corridors);
+    lvl.graph.build(map, lvl.rooms, lvl.corridors);
+    FloorList &floors = lvl.floors;
+    floors.build(map);
+
+    // place player at center of first room or random floor
+    if(!lvl.rooms.empty()){ lvl.startX = lvl.rooms[0].centerX(); lvl.startY = lvl.rooms[0].centerY(); }
+    else { auto p = random_floor_tile(map, floors, rng); lvl.startX=p.first; lvl.startY=p.second; }
+    // connectivity check: a split map is carved back together from the spawn, so every tile
+    // handed out below is reachable
+    label_components(lvl.comps, map, lvl.startX, lvl.startY);
+    if(lvl.comps.count > 1){
+        repair_components(map, lvl.comps, lvl.startX, lvl.startY);
+        floors.build(map);
+    }
+    floors.exclude(map.idx(lvl.startX, lvl.startY));
+
+    place_population(map, floors, rng, cfg, lvl.enemies, lvl.items);
+
+    lvl.field.reset(map, lvl.startX, lvl.startY);
+    lvl.fov.reset(map);
+    lvl.occ.reset(map, lvl.enemies, lvl.items);
+    lvl.scratch.reset(map, lvl.enemies.size());
+}
+
+// Endless world (--explore): the dungeon is cut into SIZE x SIZE chunks, each generated on first
+// use from its own seed by generate_map_basic, with one door on every edge that both neighbours
+// derive the same way, so each chunk connects to the next. The game itself still plays on one
+// Grid: the WINDOW x WINDOW block of chunks centred on the player's chunk, rebuilt when the
+// player steps into another chunk. Chunks own their enemies and potions (in chunk coordinates);
+// the window holds them while the chunk is in it and hands them back when it moves on. Chunks
+// are kept in CACHE slots; the least recently used one is written to DIR/chunk_<x>_<y>.bin to
+// make room and read back on the next visit, so memory stays flat however far the player goes.
+// With an empty DIR nothing goes to disk and an evicted chunk comes back as freshly generated.
+// The window has no rooms or corridors, so its room graph is empty and dormant enemies stay put.
+const uint32_t CHUNK_MAGIC = 0x4B434752; // "RGCK"
+const uint32_t CHUNK_VERSION = 1;
+
+// Chunk file layout: header, SIZE*SIZE cell bytes, enemy x, y and hp as int32 arrays, items.
+struct ChunkHeader {
+    uint32_t magic, version;
+    uint64_t seed;
+    int32_t cx, cy, size, enemyCount, itemCount, pad;
+};
+
+struct ChunkWorld {
+    static const int SIZE = 24;   // tiles per chunk side
+    static const int WINDOW = 3;  // chunks per window side; the player is always in the middle one
+    static const int CACHE = 25;  // chunks kept in memory
+    static_assert(CACHE >= WINDOW*WINDOW, "the whole window must fit in the cache");
+    struct Chunk {
+        int cx = 0, cy = 0;
+        uint64_t lastUse = 0;     // 0: empty slot
+        vector<uint8_t> cells;    // SIZE*SIZE terrain bits, row-major
+        EnemyList enemies;        // in chunk coordinates
+        LevelVec<Item> items;
+    };
+    string dir;
+    DiffConfig cfg = diffConfigs[NORMAL];
+    uint64_t seed = 0;
+    int originX = 0, originY = 0; // chunk coordinates of the window's top-left chunk
+    int spawnX = 0, spawnY = 0;   // player start, inside chunk (0,0)
+    long long generated = 0, reloaded = 0, evicted = 0;
+    vector<Chunk> cache;
+    Chunk *window[WINDOW*WINDOW] = {};
+    uint64_t useClock = 0;
+    bool diskError = false;
+    // generation and file buffers, reused for every chunk
+    Grid chunkMap;
+    LevelVec<Rect> chunkRooms;
+    FloorList chunkFloors;
+    vector<uint8_t> buf;
+
+    explicit ChunkWorld(string directory) : dir(std::move(directory)), cache(CACHE) {}
+
+    static uint64_t chunk_seed(uint64_t gameSeed, int cx, int cy){
+        return mix_seed(gameSeed ^ mix_seed(((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy));
+    }
+    // Row (side 0, the edge east of chunk (cx,cy)) or column (side 1, the edge south of it) where
+    // that edge is open. Derived from (cx,cy) alone, so the neighbour across it finds the same one.
+    int door(int cx, int cy, int side) const {
+        return 1 + (int)(mix_seed(chunk_seed(seed, cx, cy) + 1 + side) % (SIZE - 2));
+    }
+    string path(int cx, int cy) const { return dir + "/chunk_" + to_string(cx) + "_" + to_string(cy) + ".bin"; }
+
+    // A fresh world for g's seed and difficulty, with g in the window around chunk (0,0). Chunk
+    // files an earlier world left in dir are deleted first.
+    void start(Game &g){
+        if(!dir.empty()) mkdir(dir.c_str(), 0755);
+        if(DIR *d = dir.empty() ? nullptr : opendir(dir.c_str())){
+            while(dirent *ent = readdir(d)){
+                string name = ent->d_name;
+                if(name.compare(0, 6, "chunk_") == 0) unlink((dir + "/" + name).c_str());
+            }
+            closedir(d);
+        }
+        cfg = g.config; seed = g.seed;
+        for(auto &c: cache) c.lastUse = 0;
+        useClock = 0;
+        generated = reloaded = evicted = 0;
+        originX = originY = -(WINDOW/2);
+        g.depth = 1;
+        g.begin_level();
+        g.map.resize(WINDOW*SIZE, WINDOW*SIZE);
+        fill_window(g);
+        g.startX = spawnX + (WINDOW/2)*SIZE; g.startY = spawnY + (WINDOW/2)*SIZE;
+        g.playerX = g.startX; g.playerY = g.startY;
+        rebuild(g);
+    }
+
+    bool centered(int x, int y) const {
+        return x >= (WINDOW/2)*SIZE && x < (WINDOW/2+1)*SIZE && y >= (WINDOW/2)*SIZE && y < (WINDOW/2+1)*SIZE;
+    }
+    // Moves the window so the player's chunk is in the middle again: hands the window's enemies
+    // and items back to their chunks, then loads the new window around the player.
+    void recenter(Game &g){
+        int dx = g.playerX / SIZE - WINDOW/2, dy = g.playerY / SIZE - WINDOW/2;
+        for(Chunk *c: window){ c->enemies.clear(); c->items.clear(); }
+        EnemyList &en = g.enemies;
+        for(size_t i=0;i<en.size();++i) window[(en.y[i]/SIZE)*WINDOW + en.x[i]/SIZE]->enemies.push(en.x[i] % SIZE, en.y[i] % SIZE, en.hp[i]);
+        for(auto &it: g.items) window[(it.y/SIZE)*WINDOW + it.x/SIZE]->items.push_back({it.x % SIZE, it.y % SIZE});
+        originX += dx; originY += dy;
+        g.playerX -= dx*SIZE; g.playerY -= dy*SIZE;
+        fill_window(g);
+        rebuild(g);
+    }
+
+private:
+    // Chunk (cx,cy) from the cache, the disk or the generator, evicting the least recently used.
+    // The window's chunks are always the most recent, so filling a window never evicts its own.
+    Chunk &get(int cx, int cy){
+        ++useClock;
+        Chunk *victim = &cache[0];
+        for(auto &c: cache){
+            if(c.lastUse && c.cx==cx && c.cy==cy){ c.lastUse = useClock; return c; }
+            if(c.lastUse < victim->lastUse) victim = &c;
+        }
+        if(victim->lastUse){ store(*victim); evicted++; }
+        victim->cx = cx; victim->cy = cy; victim->lastUse = useClock;
+        if(load(*victim)) reloaded++;
+        else { generate(*victim); generated++; }
+        return *victim;
+    }
+
+    // the window's terrain, enemies and items in window coordinates
+    void fill_window(Game &g){
+        Grid &map = g.map;
+        g.enemies.clear(); g.items.clear();
+        for(int j=0;j<WINDOW;j++) for(int i=0;i<WINDOW;i++){
+            Chunk &c = get(originX + i, originY + j);
+            window[j*WINDOW + i] = &c;
+            int ox = i*SIZE, oy = j*SIZE;
+            for(int y=0;y<SIZE;y++) memcpy(&map.cells[map.idx(ox, oy + y)], &c.cells[(size_t)y*SIZE], SIZE);
+            for(size_t e=0;e<c.enemies.size();++e) g.enemies.push(ox + c.enemies.x[e], oy + c.enemies.y[e], c.enemies.hp[e]);
+            for(auto &it: c.items) g.items.push_back({ox + it.x, oy + it.y});
+        }
+    }
+    // derived structures for a new window, as generate_level leaves them for a new floor
+    void rebuild(Game &g){
+        g.rooms.clear(); g.corridors.clear();
+        g.graph.build(g.map, g.rooms, g.corridors);
+        g.floors.build(g.map);
+        label_components(g.comps, g.map, g.playerX, g.playerY);
+        g.field.reset(g.map, g.playerX, g.playerY);
+        g.fov.reset(g.map);
+        g.occ.reset(g.map, g.enemies, g.items);
+        g.scratch.reset(g.map, g.enemies.size());
+    }
+
+    void generate(Chunk &c){
+        Grid &map = chunkMap;
+        if(map.w != SIZE) map.resize(SIZE, SIZE);
+        Rng rng(chunk_seed(seed, c.cx, c.cy));
+        generate_map_basic(map, chunkRooms, rng);
+        // a corridor from the nearest room centre out through each edge's door
+        auto open_door = [&](int tx, int ty, bool northSouth){
+            int px = SIZE/2, py = SIZE/2, best = INT_MAX;
+            for(auto &r: chunkRooms){
+                int d = abs(r.centerX() - tx) + abs(r.centerY() - ty);
+                if(d < best){ best = d; px = r.centerX(); py = r.centerY(); }
+            }
+            if(northSouth){ carve_h(map, px, tx, py); carve_v(map, py, ty, tx); }
+            else { carve_v(map, py, ty, px); carve_h(map, px, tx, ty); }
+        };
+        open_door(SIZE-1, door(c.cx, c.cy, 0), false);
+        open_door(0, door(c.cx-1, c.cy, 0), false);
+        open_door(door(c.cx, c.cy, 1), SIZE-1, true);
+        open_door(door(c.cx, c.cy-1, 1), 0, true);
+        // rooms are chained and every door joins one, so all floor is connected
+        FloorList &floors = chunkFloors;
+        floors.build(map);
+        if(c.cx==0 && c.cy==0){
+            spawnX = chunkRooms.empty() ? SIZE/2 : chunkRooms[0].centerX();
+            spawnY = chunkRooms.empty() ? SIZE/2 : chunkRooms[0].centerY();
+            floors.exclude(map.idx(spawnX, spawnY));
+        }
+        place_population(map, floors, rng, cfg, c.enemies, c.items);
+        c.cells.resize((size_t)SIZE*SIZE);
+        for(int y=0;y<SIZE;y++) memcpy(&c.cells[(size_t)y*SIZE], &map.cells[map.idx(0, y)], SIZE);
+    }
+
+    // Writes next to the chunk's file and renames over it, like save_snapshot. A failed write is
+    // reported once; the chunk then comes back freshly generated on its next visit.
+    void store(const Chunk &c){
+        if(dir.empty()) return;
+        ChunkHeader hd{CHUNK_MAGIC, CHUNK_VERSION, seed, c.cx, c.cy, SIZE, (int32_t)c.enemies.size(), (int32_t)c.items.size(), 0};
+        buf.clear();
+        auto put = [&](const void *src, size_t bytes){ const uint8_t *p = (const uint8_t*)src; buf.insert(buf.end(), p, p + bytes); };
+        put(&hd, sizeof hd);
+        put(c.cells.data(), c.cells.size());
+        put(c.enemies.x.data(), c.enemies.size() * sizeof(int32_t));
+        put(c.enemies.y.data(), c.enemies.size() * sizeof(int32_t));
+        put(c.enemies.hp.data(), c.enemies.size() * sizeof(int32_t));
+        put(c.items.data(), c.items.size() * sizeof(Item));
+        string file = path(c.cx, c.cy), tmp = file + ".tmp";
+        bool ok;
+        {
+            ofstream ofs(tmp, ios::binary | ios::trunc);
+            ok = (bool)ofs.write((const char*)buf.data(), (streamsize)buf.size());
+        }
+        ok = ok && rename(tmp.c_str(), file.c_str()) == 0;
+        if(!ok && !diskError) cerr << "Could not write chunks to " << dir << "; evicted chunks will be regenerated\n";
+        diskError = diskError || !ok;
+    }
+
+    // Reads the chunk back if its file is there and belongs to this world; positions are checked
+    // against the chunk's own terrain, so a damaged file is ignored rather than trusted.
+    bool load(Chunk &c){
+        if(dir.empty()) return false;
+        MappedFile file(path(c.cx, c.cy));
+        if(!file.data || file.size < sizeof(ChunkHeader)) return false;
+        const ChunkHeader &hd = *(const ChunkHeader*)file.data;
+        if(hd.magic != CHUNK_MAGIC || hd.version != CHUNK_VERSION || hd.seed != seed) return false;
+        if(hd.cx != c.cx || hd.cy != c.cy || hd.size != SIZE) return false;
+        if(hd.enemyCount < 0 || hd.itemCount < 0 || hd.enemyCount > SIZE*SIZE || hd.itemCount > SIZE*SIZE) return false;
+        size_t n = (size_t)hd.enemyCount;
+        if(file.size != sizeof hd + (size_t)SIZE*SIZE + n * 3 * sizeof(int32_t) + (size_t)hd.itemCount * sizeof(Item)) return false;
+        const uint8_t *cells = (const uint8_t*)file.data + sizeof hd;
+        const int32_t *ex = (const int32_t*)(cells + SIZE*SIZE), *ey = ex + n, *ehp = ey + n;
+        const Item *items = (const Item*)(ehp + n);
+        auto floor = [&](int x, int y){ return x>=0 && x<SIZE && y>=0 && y<SIZE && (cells[y*SIZE + x] & CELL_FLOOR); };
+        for(size_t i=0;i<n;i++) if(!floor(ex[i], ey[i])) return false;
+        for(int i=0;i<hd.itemCount;i++) if(!floor(items[i].x, items[i].y)) return false;
+        c.cells.assign(cells, cells + SIZE*SIZE);
+        c.enemies.clear();
+        for(size_t i=0;i<n;i++) c.enemies.push(ex[i], ey[i], ehp[i]);
+        c.items.assign(items, items + hd.itemCount);
+        return true;
+    }
+};
+
+// regenerate_map: first floor of a fresh game plus the starting player stats
+void regenerate_map(Game &g) {
+    if(g.world) g.world->start(g);
+    else generate_level(g, g.config, g.map.w, g.map.h, g.seed, 1);
+    g.playerX = g.startX; g.playerY = g.startY;
+
+    const DiffConfig &cfg = g.config;
+    // player stats: we set defaults here; caller may override
+    g.playerMaxHP = 20;
+    g.playerAttack = 4;
+    // enemy attack damage choose base from config min..max for simplicity — we can take average
+    g.enemyAttackDamage = rnd(g.rng, cfg.enemyAtkMin, cfg.enemyAtkMax);
+    g.potionHeal = 0; // unused; actual potion heal random 6-10 per pickup
+    g.score = 0;
+}
+
+// Builds upcoming floors on worker threads so descending never waits for generation. Workers
+// claim depths in order and park finished floors in a ring of `capacity` slots; a worker only
+// starts depth d once depth d-capacity has been taken, which bounds memory. take() swaps the
+// floor out of its slot and is O(1) unless the floor is still being built. The floor it
+// replaces goes on a freelist and the next build reuses its arena, so a long descent stops
+// allocating once the ring is warm.
+struct LevelPipeline {
+    DiffConfig cfg;
+    int mapW, mapH;
+    uint64_t seed;
+    vector<LevelState> slots;
+    vector<int> slotDepth;   // depth held by each slot, -1 when empty
+    vector<LevelState> spare; // floors handed back by take(), rebuilt in place by the workers
+    int nextBuild, nextTake;
+    bool stopping = false;
+    mutex m;
+    condition_variable roomToBuild, levelReady;
+    vector<thread> workers;
+
+    LevelPipeline(const DiffConfig &c, int w, int h, uint64_t gameSeed, int firstDepth, int workerCount, int capacity)
+        : cfg(c), mapW(w), mapH(h), seed(gameSeed), slots(capacity), slotDepth(capacity, -1),
+          nextBuild(firstDepth), nextTake(firstDepth) {
+        spare.reserve(capacity + 1);
+        for(int i=0;i<workerCount;i++) workers.emplace_back([this]{ work(); });
+    }
+    ~LevelPipeline(){
+        { lock_guard<mutex> lk(m); stopping = true; }
+        roomToBuild.notify_all();
+        for(auto &t: workers) t.join();
+    }
+
+    void work(){
+        unique_lock<mutex> lk(m);
+        while(true){
+            roomToBuild.wait(lk, [&]{ return stopping || nextBuild < nextTake + (int)slots.size(); });
+            if(stopping) return;
+            int depth = nextBuild++;
+            LevelState lvl;
+            if(!spare.empty()){ lvl = std::move(spare.back()); spare.pop_back(); }
+            lk.unlock();
+            generate_level(lvl, cfg, mapW, mapH, seed, depth);
+            lk.lock();
+            int s = depth % (int)slots.size();
+            slots[s] = std::move(lvl);
+            slotDepth[s] = depth;
+            levelReady.notify_all();
+        }
+    }
+
+    // swaps floor `depth` into `lvl` and keeps the floor it held for a later build;
+    // floors must be taken in depth order
+    void take(int depth, LevelState &lvl){
+        unique_lock<mutex> lk(m);
+        int s = depth % (int)slots.size();
+        levelReady.wait(lk, [&]{ return slotDepth[s] == depth; });
+        swap(lvl, slots[s]);
+        spare.push_back(std::move(slots[s]));
+        slotDepth[s] = -1;
+        nextTake = depth + 1;
+        roomToBuild.notify_all();
+    }
+};
+
+// Swaps in the next floor (prepared by the pipeline when there is one) and puts the player on
+// its spawn tile. Score, HP and turn count carry over.
+void descend(Game &g){
+    int depth = g.depth + 1;
+    if(g.pipeline) g.pipeline->take(depth, g);
+    else generate_level(g, g.config, g.map.w, g.map.h, g.seed, depth);
+    g.playerX = g.startX; g.playerY = g.startY;
+    g.events.push(EV_DESCEND, depth);
+}
+
+int enemy_index_at(const Grid &map, const Occupancy &occ, int x,int y){ return occ.enemy[map.idx(x,y)]; }
+int item_index_at(const Grid &map, const Occupancy &occ, int x,int y){ return occ.item[map.idx(x,y)]; }
+
+// Fresh game on a new map of the given size; seed fixes everything that happens in it.
+// custom replaces diffConfigs[diff] for this game when given
+void new_game(Game &g, Difficulty diff, int mapW, int mapH, uint64_t seed, const DiffConfig *custom = nullptr){
+    g.diff = diff;
+    g.config = custom ? *custom : diffConfigs[diff];
+    g.seed = seed;
+    g.rng.seed(seed);
+    g.map.resize(mapW, mapH);
+    regenerate_map(g);
+    g.playerHP = g.playerMaxHP;
+    g.turns = 0;
+    g.quit = false;
+}
+
+// Enemies wake when the player can see them within ACTIVATION_RADIUS tiles; the rest only plan
+// every DORMANT_TICK turns, and then over the room graph rather than the distance field, so a big
+// map's far rooms cost next to nothing per turn.
+const int ACTIVATION_RADIUS = 8;
+const int DORMANT_TICK = 4;
+
+// The player stepping onto floor tile (nx,ny) next to them: attacks the enemy standing there,
+// or picks up the potion there and moves. Uses a turn either way.
+void player_enter(Game &g, int nx, int ny){
+    Grid &map = g.map;
+    EnemyList &enemies = g.enemies;
+    Occupancy &occ = g.occ;
+    int &playerHP = g.playerHP;
+    EventLog &events = g.events;
+    // Is there an enemy at destination?
+    int eidx = enemy_index_at(map, occ, nx, ny);
+    if(eidx != -1){
+        // attack enemy
+        events.push(EV_PLAYER_HIT, g.playerAttack);
+        enemies.hp[eidx] -= g.playerAttack;
+        if(enemies.hp[eidx] <= 0){
+            events.push(EV_ENEMY_KILLED);
+            occ.kill_enemy(map, enemies, eidx);
+            g.score += 10; // new scoring: +10 per kill
+            // move player into tile of dead enemy
+            g.playerX = nx; g.playerY = ny;
+        } else {
+            events.push(EV_ENEMY_WOUNDED, enemies.hp[eidx]);
+            // player stays in place after attacking
+        }
+        g.turns++;
+    } else {
+        // Is there an item there?
+        int itidx = item_index_at(map, occ, nx, ny);
+        if(itidx != -1){
+            int heal = rnd(g.rng, 6,10); // potions heal 6-10
+            int before = playerHP;
+            playerHP = min(g.playerMaxHP, playerHP + heal);
+            events.push(EV_POTION, playerHP - before, heal);
+            // remove item
+            occ.remove_item(map, g.items, itidx);
+        }
+        // move player
+        g.playerX = nx; g.playerY = ny;
+        g.turns++;
+    }
+}
+
+template<class Diff> void enemy_turn(Game &g, const Diff &diff);
+
+// Advances the game by one action: the player's move/attack/pickup, then the enemy turn.
+// Returns false when the action did not use a turn (quitting, or moving off the map).
+// Instantiated per difficulty policy; step() below picks the instantiation.
+template<class Diff>
+bool step_as(Game &g, Action act, const Diff &diff){
+    if(act==ACT_QUIT){ g.quit = true; return false; }
+    PROFILE_TURN();
+    PROFILE_PHASES(phases);
+    PROFILE_SWITCH(phases, PH_PLAYER);
+    const Grid &map = g.map;
+    int nx = g.playerX, ny = g.playerY;
+    if(act==ACT_UP) ny--;
+    else if(act==ACT_DOWN) ny++;
+    else if(act==ACT_LEFT) nx--;
+    else nx++;
+    if(!map.in_bounds(nx,ny)){
+        g.events.push(EV_OUT_OF_BOUNDS);
+        return false;
+    }
+    if(!map.floor(nx,ny)){
+        g.events.push(EV_WALL);
+        // count as a turn; enemies still take their turn
+        g.turns++;
+    } else player_enter(g, nx, ny);
+    PROFILE_STOP(phases);
+    enemy_turn(g, diff);
+    return true;
+}
+
+// The rest of a turn once the player has acted: enemies plan, attack and move, then the floor
+// changes if it was cleared (or the endless world's window follows the player).
+template<class Diff>
+void enemy_turn(Game &g, const Diff &diff){
+    PROFILE_PHASES(phases);
+    Grid &map = g.map;
+    EnemyList &enemies = g.enemies;
+    Occupancy &occ = g.occ;
+    int &playerX = g.playerX, &playerY = g.playerY, &playerHP = g.playerHP;
+    EventLog &events = g.events;
+    Rng &rng = g.rng;
+
+    // Enemy turn: each enemy steps down a shared player-rooted distance field, avoiding walls and other enemies.
+    // Moves are simultaneous without stacking: every enemy plans against the start positions, then
+    // resolve_moves settles the whole batch; ties for a tile go to the earlier enemy.
+    PROFILE_SWITCH(phases, PH_PLAN);
+    TurnScratch &scratch = g.scratch;
+    scratch.begin_turn(enemies.size());
+    LevelVec<pair<int,int>> &nextPos = scratch.nextPos;
+    LevelVec<int> &ex = enemies.x, &ey = enemies.y;
+    // Enemies that see the player step down the field. Out of sight they are dormant and only
+    // plan on tick turns, over the room graph; enemies the field cannot reach never do. The field
+    // is left at its old root while nobody sees the player.
+    bool tick = g.turns % DORMANT_TICK == 0;
+    int seeing = 0;
+    for(size_t i=0;i<enemies.size();++i){
+        uint8_t mode = TurnScratch::ASLEEP;
+        if(g.field.at(map, ex[i], ey[i]) != DistanceField::UNREACHED){
+            int dx = ex[i] - playerX, dy = ey[i] - playerY;
+            bool sees = dx*dx + dy*dy <= ACTIVATION_RADIUS*ACTIVATION_RADIUS;
+            if(sees){
+                g.fov.update(map, playerX, playerY, ACTIVATION_RADIUS); // once per player position
+                sees = g.fov.visible(map.idx(ex[i], ey[i]));
+            }
+            mode = sees ? TurnScratch::SEES : tick ? TurnScratch::ROUTES : TurnScratch::ASLEEP;
+        }
+        scratch.mode[i] = mode;
+        seeing += mode==TurnScratch::SEES;
+    }
+    if(seeing) g.field.move_root(map, playerX, playerY);
+    RoomGraph::Goal goal;
+    if(tick) goal = g.graph.aim(g.rooms, playerX, playerY);
+    for(size_t i=0;i<enemies.size();++i){
+        pair<int,int> to = {ex[i], ey[i]};
+        // occupancy still holds everyone's start position here; an enemy's own tile is never its neighbour
+        if(scratch.mode[i]==TurnScratch::SEES) to = field_next_step(map, g.field, ex[i], ey[i], playerX, playerY, occ);
+        else if(scratch.mode[i]==TurnScratch::ROUTES){
+            to = g.graph.next_step(g.rooms, goal, ex[i], ey[i]);
+            if(!map.in_bounds(to.first, to.second) || !map.floor(to.first, to.second)) to = {ex[i], ey[i]};
+        }
+        nextPos[i] = to;
+        int c = map.idx(to.first, to.second);
+        bool attacks = to.first==playerX && to.second==playerY, waits = to.first==ex[i] && to.second==ey[i];
+        // ties for a tile go to the earlier enemy
+        scratch.plan((int)i, attacks || waits || !scratch.claim(c) ? TurnScratch::STAY : occ.enemy[c]);
+    }
+    PROFILE_SWITCH(phases, PH_RESOLVE);
+    for(size_t i=0;i<enemies.size();++i){
+        if(nextPos[i].first==playerX && nextPos[i].second==playerY){
+            // enemy attacks player and stays adjacent
+            int edmg = diff.attack_roll(rng);
+            events.push(EV_ENEMY_ATTACK, edmg);
+            playerHP -= edmg;
+        }
+    }
+    resolve_moves(scratch, map, enemies, occ);
+
+    PROFILE_SWITCH(phases, PH_COLLIDE);
+    // After enemies moved, check if any enemy occupies player's tile (if they moved into it) -> attack already handled above for intended==player tile.
+    for(size_t i=0;i<enemies.size();++i){
+        if(ex[i]==playerX && ey[i]==playerY){
+            // If we reach here and player still alive, enemy deals damage (if not already applied)
+            // To avoid double applying, we already applied damage when intended==player tile above; but if an enemy moved onto player in resolution, we attack now as well.
+            // For safety, apply a small fixed damage if player shares tile:
+            int edmg = diff.attack_roll(rng);
+            events.push(EV_ENEMY_BUMP, edmg);
+            playerHP -= edmg;
+        }
+    }
+
+    // small cap
+    if(playerHP > 999) playerHP = 999;
+
+    if(g.world && playerHP > 0 && !g.world->centered(playerX, playerY)){
+        PROFILE_SWITCH(phases, PH_DESCEND); // the endless world's counterpart of a new floor
+        g.world->recenter(g);
+    }
+    if(playerHP > 0 && g.cleared() && g.can_descend()){
+        PROFILE_SWITCH(phases, PH_DESCEND);
+        descend(g);
+    }
+}
+
+bool step(Game &g, Action act){
+    bool used;
+    if(!(g.config == diffConfigs[g.diff])) used = step_as(g, act, RuntimeDiff{g.config});
+    else switch(g.diff){
+    case EASY: used = step_as(g, act, FixedDiff<EASY>()); break;
+    case HARD: used = step_as(g, act, FixedDiff<HARD>()); break;
+    default:   used = step_as(g, act, FixedDiff<NORMAL>()); break;
+    }
+    g.events.flush(g.turns);
+    return used;
+}
+
+// A plain batch driver for reinforcement-learning style workloads: step(actions) moves each of
+// its games one turn under the headless rules (see play_headless) and reports each game's
+// reward (score gained) and whether it ended. Ended games start their next one at once; they
+// are numbered like --sim games, so game k has the same seed. The games are stepped one after
+// another through step(); nothing is packed or vectorised across them. Nearly all of a turn is
+// the enemy turn (FOV and distance field), which is per-game work, and a version that mirrored
+// positions, HP and floors into SoA columns ran within noise of this loop.
+struct BatchEnv {
+    int count = 0, w = 0, h = 0;
+    int maxTurns = 1000;
+    Difficulty diff = NORMAL;
+    uint64_t seed = 0;
+    long long started = 0;                      // games started so far
+    vector<Game> games;
+    vector<float> reward;
+    vector<uint8_t> done;
+
+    void reset(int gameCount, Difficulty d, int mapW, int mapH, uint64_t baseSeed, int turnCap = 1000){
+        count = gameCount; diff = d; w = mapW; h = mapH; seed = baseSeed; maxTurns = turnCap;
+        started = 0;
+        games.clear();
+        games.resize(count);
+        reward.assign(count, 0.0f);
+        done.assign(count, 0);
+        for(int i=0;i<count;i++) start_game(i);
+    }
+
+    // actions[i] in ACT_UP..ACT_RIGHT for every game
+    void step(const uint8_t *actions){
+        for(int i=0;i<count;i++){
+            Game &g = games[i];
+            int before = g.score;
+            // headless rules: a move off the map wastes a turn, and enemies do not move
+            if(!::step(g, (Action)(actions[i] & 3))) g.turns++;
+            reward[i] = (float)(g.score - before);
+            done[i] = g.over() || g.turns >= maxTurns || g.cleared();
+            if(done[i]) start_game(i);
+        }
+    }
+
+private:
+    void start_game(int i){
+        Game &g = games[i];
+        g.floorLimit = 1;
+        new_game(g, diff, w, h, mix_seed(seed ^ mix_seed((uint64_t)started++)));
+    }
+};
+
+// Replays: the seed, difficulty, map size and every action fed to step(), plus a hash of the
+// game state after each one, so playback can check it is still on the recorded path turn by
+// turn. A game resumed from a save embeds that snapshot as its starting state. File layout:
+// ReplayHeader, snapshot bytes (padded to 8), one byte per action, one uint32 hash per action.
+// Bump REPLAY_VERSION when the layout or the turn rules change, since old actions no longer
+// reproduce the recorded states.
+const uint32_t REPLAY_MAGIC = 0x50524752; // "RGRP"
+const uint32_t REPLAY_VERSION = 6;
+const uint32_t REPLAY_WASTED_TURNS = 1;   // bumping a map edge costs a turn (headless rules)
+
+struct ReplayHeader {
+    uint32_t magic, version, flags;
+    int32_t diff, w, h, floorLimit, pad;
+    DiffConfig config;
+    uint64_t seed, count, snapshotBytes;
+};
+
+// Order-sensitive hash of everything step() reads or writes.
+uint32_t state_hash(const Game &g){
+    uint64_t h = mix_seed(g.rng.state ^ g.rng.inc);
+    auto add = [&](uint64_t v){ h = mix_seed(h ^ v); };
+    add((uint64_t)(uint32_t)g.playerX << 32 | (uint32_t)g.playerY);
+    add((uint64_t)(uint32_t)g.playerHP << 32 | (uint32_t)g.score);
+    add((uint64_t)(uint32_t)g.turns << 32 | (uint32_t)g.depth);
+    for(size_t i=0;i<g.enemies.size();i++)
+        add((uint64_t)(uint32_t)g.enemies.x[i] << 40 ^ (uint64_t)(uint32_t)g.enemies.y[i] << 20 ^ (uint32_t)g.enemies.hp[i]);
+    for(auto &it: g.items) add((uint64_t)(uint32_t)it.x << 32 | (uint32_t)it.y);
+    return (uint32_t)(h ^ h >> 32);
+}
+
+struct Replay {
+    uint32_t flags = 0;
+    Difficulty diff = NORMAL;
+    DiffConfig config = diffConfigs[NORMAL];
+    int w = MAP_W, h = MAP_H, floorLimit = 0;
+    uint64_t seed = 0;
+    vector<uint8_t> snapshot;   // start state when the game was loaded from a save
+    vector<uint8_t> actions;
+    vector<uint32_t> hashes;    // state_hash after each action
+
+    // remember g's current state as the start of the recording
+    void begin(const Game &g, uint32_t replayFlags, bool resumed){
+        flags = replayFlags; diff = g.diff; config = g.config; w = g.map.w; h = g.map.h; floorLimit = g.floorLimit; seed = g.seed;
+        snapshot.clear();
+        if(resumed) write_snapshot(g, snapshot);
+        actions.clear(); hashes.clear();
+    }
+    void record(Action act, const Game &after){ actions.push_back((uint8_t)act); hashes.push_back(state_hash(after)); }
+    // puts g in the recorded start state
+    bool start(Game &g) const {
+        if(!snapshot.empty()){
+            SnapshotView view;
+            return view.open(snapshot.data(), snapshot.size()) && restore_snapshot(g, view);
+        }
+        g.floorLimit = floorLimit;
+        new_game(g, diff, w, h, seed, &config);
+        return true;
+    }
+};
+
+bool save_replay(const Replay &r, const string &path){
+    ReplayHeader hd;
+    memset(&hd, 0, sizeof hd);
+    hd.magic = REPLAY_MAGIC; hd.version = REPLAY_VERSION; hd.flags = r.flags;
+    hd.diff = (int)r.diff; hd.w = r.w; hd.h = r.h; hd.floorLimit = r.floorLimit; hd.config = r.config;
+    hd.seed = r.seed; hd.count = r.actions.size(); hd.snapshotBytes = r.snapshot.size();
+    ofstream ofs(path, ios::binary | ios::trunc);
+    static const char zeros[8] = {};
+    ofs.write((const char*)&hd, sizeof hd);
+    ofs.write((const char*)r.snapshot.data(), (streamsize)r.snapshot.size());
+    ofs.write(zeros, (streamsize)((8 - r.snapshot.size() % 8) % 8));
+    ofs.write((const char*)r.actions.data(), (streamsize)r.actions.size());
+    ofs.write((const char*)r.hashes.data(), (streamsize)(r.hashes.size() * sizeof(uint32_t)));
+    return (bool)ofs;
+}
+
+bool load_replay(Replay &r, const string &path){
+    MappedFile file(path);
+    if(!file.data || file.size < sizeof(ReplayHeader)) return false;
+    const uint8_t *p = (const uint8_t*)file.data;
+    ReplayHeader hd;
+    memcpy(&hd, p, sizeof hd);
+    if(hd.magic != REPLAY_MAGIC || hd.version != REPLAY_VERSION || hd.diff < 0 || hd.diff > 2) return false;
+    if(hd.snapshotBytes > file.size || hd.count > file.size) return false;
+    uint64_t snapEnd = sizeof hd + ((hd.snapshotBytes + 7) & ~7ull);
+    if(snapEnd + hd.count * 5 != file.size) return false;
+    r.flags = hd.flags; r.diff = (Difficulty)hd.diff; r.w = hd.w; r.h = hd.h; r.floorLimit = hd.floorLimit; r.seed = hd.seed;
+    r.config = hd.config;
+    r.snapshot.assign(p + sizeof hd, p + sizeof hd + hd.snapshotBytes);
+    r.actions.assign(p + snapEnd, p + snapEnd + hd.count);
+    r.hashes.resize(hd.count);
+    memcpy(r.hashes.data(), p + snapEnd + hd.count, hd.count * sizeof(uint32_t));
+    for(uint8_t a: r.actions) if(a > ACT_QUIT) return false;
+    // the map size limits of --size and save files
+    return r.w >= MIN_MAP_W && r.h >= MIN_MAP_H && r.w <= 1<<15 && r.h <= 1<<15 && r.floorLimit >= 0 &&
+           valid_config(r.config);
+}
+
+// Applies one recorded action the way the recording session did.
+inline void replay_step(Game &g, Action act, uint32_t flags){
+    if(!step(g, act) && !g.quit && (flags & REPLAY_WASTED_TURNS)) g.turns++;
+}
+
+// Re-runs r headless in g. Returns the index of the first action after which the state differs
+// from the recording, or -1 when every turn matched.
+long long play_replay(const Replay &r, Game &g){
+    if(!r.start(g)) return 0;
+    g.events.detach(); g.pipeline = nullptr;
+    for(size_t i=0;i<r.actions.size();i++){
+        replay_step(g, (Action)r.actions[i], r.flags);
+        if(state_hash(g) != r.hashes[i]) return (long long)i;
+    }
+    return -1;
+}
+
+// Player policies for headless runs: next(g) returns the action to feed to step().
+
+// Replays a fixed w/a/s/d string, wrapping around at the end.
+struct ScriptedPolicy {
+    vector<Action> moves;
+    size_t pos = 0;
+    explicit ScriptedPolicy(const string &script){
+        for(char c: script){
+            if(c=='w') moves.push_back(ACT_UP);
+            else if(c=='s') moves.push_back(ACT_DOWN);
+            else if(c=='a') moves.push_back(ACT_LEFT);
+            else if(c=='d') moves.push_back(ACT_RIGHT);
+        }
+        if(moves.empty()) moves.push_back(ACT_RIGHT);
+    }
+    Action next(const Game &){ Action a = moves[pos]; pos = (pos+1) % moves.size(); return a; }
+};
+
+// Simple AI: walks toward the closest alive enemy (or the closest potion when hurt) by
+// following the game's player-rooted distance field back from the target.
+struct ChasePolicy {
+    Rng rng; // only used to wander when nothing is reachable
+    explicit ChasePolicy(uint64_t seed) : rng(seed) {}
+    Action next(Game &g){
+        const Grid &map = g.map;
+        // the enemy turn skips the field while every enemy is dormant
+        g.field.move_root(map, g.playerX, g.playerY);
+        const DistanceField &f = g.field;
+        int target = -1, best = DistanceField::UNREACHED;
+        auto consider = [&](int x,int y){
+            int d = f.at(map,x,y);
+            if(d>0 && d<best){ best = d; target = map.idx(x,y); }
+        };
+        if(g.playerHP*2 < g.playerMaxHP) for(auto &it: g.items) consider(it.x, it.y);
+        if(target==-1) for(size_t i=0;i<g.enemies.size();++i) consider(g.enemies.x[i], g.enemies.y[i]);
+        if(target==-1) return (Action)rnd(rng, 0,3); // nothing reachable: wander
+        // walk downhill from the target until we reach a tile next to the player
+        const int dirs[4] = {-map.stride, map.stride, -1, 1}; // indexed by Action
+        int cur = target;
+        while(f.dist[cur] > 1){
+            for(int d: dirs) if(f.dist[cur+d] == f.dist[cur]-1){ cur += d; break; }
+        }
+        int from = map.idx(g.playerX, g.playerY);
+        for(int a=0;a<4;a++) if(from + dirs[a] == cur) return (Action)a;
+        return ACT_RIGHT;
+    }
+};
+
+// Plays one headless game to completion: the player dies, the floor is cleared, or maxTurns
+// turns have passed.
+template<class Policy>
+void play_headless(Game &g, Policy &policy, int maxTurns, Replay *rec = nullptr){
+    if(rec) rec->begin(g, REPLAY_WASTED_TURNS, false);
+    while(!g.over() && g.turns < maxTurns && !g.cleared()){
+        Action act = policy.next(g);
+        replay_step(g, act, REPLAY_WASTED_TURNS); // wasted input still counts toward the cap
+        if(rec) rec->record(act, g);
+    }
+}
+
+struct SimConfig {
+    int games = 0;
+    unsigned seed = 1;
+    int threads = 0; // 0: one per hardware thread
+    Difficulty diff = NORMAL;
+    int mapW = MAP_W, mapH = MAP_H;
+    int maxTurns = 1000;
+    int floors = 1; // floors per game; more than 1 descends on every clear
+    string script; // empty: ChasePolicy
+    string scores; // leaderboard file every result is submitted to; empty: none
+    string profile; // JSON file for the merged turn profile; empty: none
+    string recordDir; // directory to write game_<i>.rpl replays to; empty: none
+    string exploreDir; // endless worlds instead of floors, worker t parking chunks in DIR/worker_<t>; empty: floors
+    bool customConfig = false; // config replaces diffConfigs[diff] (--config)
+    DiffConfig config = diffConfigs[NORMAL];
+};
+
+// Per-thread totals, padded to a cache line so workers never share one while counting.
+struct alignas(64) SimStats {
+    long long games = 0, turns = 0, score = 0;
+    int deaths = 0, clears = 0, bestScore = 0, longestGame = 0;
+    long long chunksGenerated = 0, chunksReloaded = 0, chunksEvicted = 0;
+    EventCounts events;  // attached to the worker's games as their only event sink
+
+    void add(const Game &g){
+        games++;
+        turns += g.turns;
+        score += g.score;
+        if(g.playerHP<=0) deaths++;
+        else if(g.cleared()) clears++;
+        bestScore = max(bestScore, g.score);
+        longestGame = max(longestGame, g.turns);
+        if(g.world){
+            chunksGenerated += g.world->generated;
+            chunksReloaded += g.world->reloaded;
+            chunksEvicted += g.world->evicted;
+        }
+    }
+    void merge(const SimStats &o){
+        games += o.games; turns += o.turns; score += o.score;
+        deaths += o.deaths; clears += o.clears;
+        bestScore = max(bestScore, o.bestScore);
+        longestGame = max(longestGame, o.longestGame);
+        chunksGenerated += o.chunksGenerated; chunksReloaded += o.chunksReloaded; chunksEvicted += o.chunksEvicted;
+        events.merge(o.events);
+    }
+};
+
+// Plays game number i of a sim run. The game's seed depends only on (cfg.seed, i), so results
+// do not depend on how games are spread over threads.
+void sim_one_game(const SimConfig &cfg, long long i, Game &g, SimStats &stats, Leaderboard *board, Replay *rec){
+    uint64_t seed = mix_seed(cfg.seed ^ mix_seed((uint64_t)i));
+    g.floorLimit = cfg.floors;
+    new_game(g, cfg.diff, cfg.mapW, cfg.mapH, seed, cfg.customConfig ? &cfg.config : nullptr);
+    if(cfg.script.empty()){ ChasePolicy p(mix_seed(seed)); play_headless(g, p, cfg.maxTurns, rec); }
+    else { ScriptedPolicy p(cfg.script); play_headless(g, p, cfg.maxTurns, rec); }
+    stats.add(g);
+    if(rec && !save_replay(*rec, cfg.recordDir + "/game_" + to_string(i) + ".rpl"))
+        fprintf(stderr, "Could not write replay %lld to %s\n", i, cfg.recordDir.c_str());
+    if(board) board->submit(score_entry(g));
+}
+
+// --sim: runs cfg.games complete games on a pool of worker threads without rendering and
+// reports throughput. Workers claim batches of game indices from one atomic counter, keep their
+// own Game and SimStats, and the stats are merged after join, so the hot path takes no locks.
+void run_sim(const SimConfig &cfg){
+    int threads = cfg.threads > 0 ? cfg.threads : (int)max(1u, thread::hardware_concurrency());
+    threads = max(1, min(threads, cfg.games));
+    const long long batch = 16;
+    atomic<long long> nextGame{0};
+    vector<SimStats> perThread(threads);
+    vector<Profile> profiles(threads);
+    optional<Leaderboard> board;
+    if(!cfg.scores.empty()) board.emplace(cfg.scores);
+    auto worker = [&](int t){
+        Game g;
+        Replay rec;
+        optional<ChunkWorld> world;
+        if(!cfg.exploreDir.empty()){ world.emplace(cfg.exploreDir + "/worker_" + to_string(t)); g.world = &*world; }
+        SimStats &stats = perThread[t];
+        g.events.counts = &stats.events;
+        tl_profile = Profile();
+        while(true){
+            long long begin = nextGame.fetch_add(batch, memory_order_relaxed);
+            if(begin >= cfg.games) break;
+            long long end = min<long long>(begin + batch, cfg.games);
+            for(long long i=begin;i<end;i++) sim_one_game(cfg, i, g, stats, board ? &*board : nullptr, cfg.recordDir.empty() ? nullptr : &rec);
+            if(board) board->maybe_flush(1024);
+        }
+        profiles[t] = tl_profile;
+    };
+    auto t0 = chrono::steady_clock::now();
+    vector<thread> pool;
+    for(int t=1;t<threads;t++) pool.emplace_back(worker, t);
+    worker(0);
+    for(auto &th: pool) th.join();
+    if(board) board->flush(true);
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+    SimStats total;
+    for(auto &st: perThread) total.merge(st);
+    Profile prof;
+    for(auto &p: profiles) prof.merge(p);
+    printf("games: %lld  seed: %u  map: %dx%d  threads: %d\n", total.games, cfg.seed, cfg.mapW, cfg.mapH, threads);
+    printf("turns: %lld  deaths: %d  cleared: %d  avg score: %.2f  best score: %d  longest game: %d\n",
+           total.turns, total.deaths, total.clears, total.games ? (double)total.score/total.games : 0.0,
+           total.bestScore, total.longestGame);
+    printf("elapsed: %.3fs  games/sec: %.1f  turns/sec: %.1f\n",
+           secs, total.games/max(secs,1e-9), total.turns/max(secs,1e-9));
+    if(board) printf("leaderboard: %s  best: %d\n", cfg.scores.c_str(), board->best());
+    const EventCounts &ev = total.events;
+    printf("kills: %lld  potions: %lld  damage dealt: %lld  taken: %lld  healed: %lld  wall bumps: %lld\n",
+           ev.byKind[EV_ENEMY_KILLED], ev.byKind[EV_POTION], ev.damageDealt, ev.damageTaken, ev.healed, ev.byKind[EV_WALL]);
+    if(!cfg.exploreDir.empty())
+        printf("chunks: generated %lld  reloaded %lld  evicted %lld\n", total.chunksGenerated, total.chunksReloaded, total.chunksEvicted);
+#ifndef ROGUE_NO_PROFILE
+    double t = max<uint64_t>(prof.turns, 1);
+    printf("turn p50: %lluns  p99: %lluns  nodes/turn: %.1f  allocs/turn: %.3f\n",
+           (unsigned long long)prof.turnNs.percentile(0.5), (unsigned long long)prof.turnNs.percentile(0.99),
+           prof.nodes/t, prof.allocs/t);
+#endif
+    if(!cfg.profile.empty() && !prof.save_json(cfg.profile)) fprintf(stderr, "Could not write %s\n", cfg.profile.c_str());
+}
+
+// --stress SECONDS: randomised headless games under extreme settings, checking the game's
+// invariants after every turn until the time is up or one breaks. Game i's settings, seed and
+// policy depend only on (--seed, i), so a failure is replayed alone with --stress-game I. A
+// watchdog reports a worker whose game stops making progress (a generation or search that
+// never returns) instead of hanging, and the report gives turn latency per kind of game plus
+// the process's peak RSS, so a leak shows as RSS that keeps climbing between progress lines.
+enum StressKind { SK_SMALL, SK_LARGE, SK_HUGE, SK_CROWD, SK_EXPLORE, SK_COUNT };
+const char *const STRESS_KIND_NAMES[SK_COUNT] = {"small", "large", "huge", "crowd", "explore"};
+const int STRESS_STALL_SECONDS = 60;
+const int STRESS_REPORT_SECONDS = 10;
+
+struct StressGame {
+    int kind, w, h, maxTurns, floors;
+    bool chase;     // ChasePolicy, or a random walk
+    DiffConfig cfg;
+    uint64_t seed;
+};
+
+StressGame stress_game(unsigned seed, long long i){
+    Rng rng(mix_seed(seed ^ mix_seed((uint64_t)i)));
+    StressGame sg;
+    sg.kind = rnd(rng, 0, SK_COUNT - 1);
+    int enemies = 0;
+    switch(sg.kind){
+    case SK_SMALL: sg.w = rnd(rng, MIN_MAP_W, 40); sg.h = rnd(rng, MIN_MAP_H, 20); enemies = rnd(rng, 0, 12); sg.maxTurns = 2000; break;
+    case SK_LARGE: sg.w = rnd(rng, 64, 200); sg.h = rnd(rng, 32, 120); enemies = rnd(rng, 10, 200); sg.maxTurns = 1000; break;
+    case SK_HUGE:  sg.w = rnd(rng, 384, 512); sg.h = rnd(rng, 384, 512); enemies = rnd(rng, 50, 400); sg.maxTurns = 100; break;
+    case SK_CROWD: sg.w = rnd(rng, 40, 128); sg.h = rnd(rng, 20, 64); enemies = rnd(rng, 1000, 4000); sg.maxTurns = 300; break;
+    default:       sg.w = MAP_W; sg.h = MAP_H; enemies = rnd(rng, 0, 20); sg.maxTurns = 2000; break; // per chunk
+    }
+    DiffConfig &c = sg.cfg;
+    c.enemyMin = rnd(rng, 0, enemies); c.enemyMax = enemies;
+    c.enemyHpMin = rnd(rng, 1, 10); c.enemyHpMax = c.enemyHpMin + rnd(rng, 0, 40);
+    c.enemyAtkMin = rnd(rng, 0, 3); c.enemyAtkMax = c.enemyAtkMin + rnd(rng, 0, 5);
+    c.potionMin = 0; c.potionMax = rnd(rng, 0, 1) ? 0 : rnd(rng, 0, 30); // no potions at all half the time
+    sg.floors = sg.kind == SK_EXPLORE ? 0 : rnd(rng, 1, 4);
+    sg.chase = rnd(rng, 0, 1) == 0;
+    sg.seed = mix_seed(rng.next() ^ (uint64_t)rng.next() << 32);
+    return sg;
+}
+
+string describe_stress_game(const StressGame &sg){
+    const DiffConfig &c = sg.cfg;
+    char buf[192];
+    snprintf(buf, sizeof buf, "%s %dx%d enemies %d-%d hp %d-%d atk %d-%d potions %d-%d floors %d %s seed %llu",
+             STRESS_KIND_NAMES[sg.kind], sg.w, sg.h, c.enemyMin, c.enemyMax, c.enemyHpMin, c.enemyHpMax,
+             c.enemyAtkMin, c.enemyAtkMax, c.potionMin, c.potionMax, sg.floors, sg.chase ? "chase" : "walk",
+             (unsigned long long)sg.seed);
+    return buf;
+}
+
+// Everything that must hold between turns; empty when it all does.
+string check_invariants(const Game &g){
+    const Grid &map = g.map;
+    auto at = [&](int x, int y){ return "(" + to_string(x) + "," + to_string(y) + ")"; };
+    if(!map.in_bounds(g.playerX, g.playerY) || !map.floor(g.playerX, g.playerY)) return "player off the floor at " + at(g.playerX, g.playerY);
+    if(g.playerHP > g.playerMaxHP) return "player hp " + to_string(g.playerHP) + " above max " + to_string(g.playerMaxHP);
+    if(g.comps.id[map.idx(g.playerX, g.playerY)] < 0) return "player tile has no region";
+    const EnemyList &en = g.enemies;
+    for(size_t i=0;i<en.size();++i){
+        if(!map.in_bounds(en.x[i], en.y[i]) || !map.floor(en.x[i], en.y[i])) return "enemy " + to_string(i) + " off the floor at " + at(en.x[i], en.y[i]);
+        if(en.hp[i] <= 0) return "enemy " + to_string(i) + " alive with hp " + to_string(en.hp[i]);
+        // one occupancy slot per tile, so a second enemy on a tile cannot also own its slot
+        if(g.occ.enemy[map.idx(en.x[i], en.y[i])] != (int)i) return "enemy " + to_string(i) + " shares or lost its tile " + at(en.x[i], en.y[i]);
+    }
+    for(size_t i=0;i<g.items.size();++i){
+        const Item &it = g.items[i];
+        if(!map.in_bounds(it.x, it.y) || !map.floor(it.x, it.y)) return "item " + to_string(i) + " off the floor at " + at(it.x, it.y);
+        if(g.occ.item[map.idx(it.x, it.y)] != (int)i) return "item " + to_string(i) + " shares or lost its tile " + at(it.x, it.y);
+    }
+    size_t enemySlots = 0, itemSlots = 0;
+    for(int c=0;c<map.size();c++){ enemySlots += g.occ.enemy[c] != -1; itemSlots += g.occ.item[c] != -1; }
+    if(enemySlots != en.size() || itemSlots != g.items.size())
+        return "occupancy holds " + to_string(enemySlots) + " enemies and " + to_string(itemSlots) + " items, lists "
+               + to_string(en.size()) + " and " + to_string(g.items.size());
+    return "";
+}
+
+// bfs_next_step from one enemy toward the player: with or without the region labels it must come
+// back with the same step, onto a floor tile next to the enemy or the enemy's own.
+string check_search(Game &g, int i, BfsScratch &scratch){
+    const Grid &map = g.map;
+    int sx = g.enemies.x[i], sy = g.enemies.y[i];
+    pair<int,int> a = bfs_next_step(map, sx, sy, g.playerX, g.playerY, g.occ, scratch, &g.comps);
+    pair<int,int> b = bfs_next_step(map, sx, sy, g.playerX, g.playerY, g.occ, scratch);
+    if(a != b) return "bfs_next_step disagrees with and without regions for enemy " + to_string(i);
+    if(abs(a.first - sx) + abs(a.second - sy) > 1 || !map.in_bounds(a.first, a.second) || !map.floor(a.first, a.second))
+        return "bfs_next_step gave a non-adjacent or wall step for enemy " + to_string(i);
+    return "";
+}
+
+struct alignas(64) StressStats {
+    long long games[SK_COUNT] = {}, turns[SK_COUNT] = {};
+    LatencyHistogram turnNs[SK_COUNT];
+};
+// a worker's progress, and the watchdog's last look at it
+struct alignas(64) StressBeat {
+    atomic<long long> game{-1}, games{0}, turns{0};
+    long long seenTurns = -1;
+    chrono::steady_clock::time_point seenAt;
+};
+
+// Plays stress game i in g, checking after every turn; returns the first broken invariant.
+string play_stress_game(unsigned seed, long long i, Game &g, ChunkWorld &world, BfsScratch &scratch,
+                        StressStats &stats, StressBeat &beat){
+    StressGame sg = stress_game(seed, i);
+    g.world = sg.kind == SK_EXPLORE ? &world : nullptr;
+    g.floorLimit = sg.floors;
+    new_game(g, NORMAL, sg.w, sg.h, sg.seed, &sg.cfg);
+    ChasePolicy chase(mix_seed(sg.seed));
+    Rng walk(sg.seed ^ 1);
+    string err = check_invariants(g);
+    while(err.empty() && !g.over() && g.turns < sg.maxTurns && !g.cleared()){
+        Action act = sg.chase ? chase.next(g) : (Action)rnd(walk, 0, 3);
+        int turns0 = g.turns, score0 = g.score;
+        auto t0 = chrono::steady_clock::now();
+        replay_step(g, act, REPLAY_WASTED_TURNS);
+        stats.turnNs[sg.kind].add((uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t0).count());
+        beat.turns.fetch_add(1, memory_order_relaxed);
+        err = check_invariants(g);
+        if(err.empty() && g.turns != turns0 + 1) err = "turn counter went from " + to_string(turns0) + " to " + to_string(g.turns);
+        if(err.empty() && (g.score < score0 || (g.score - score0) % 10))
+            err = "score went from " + to_string(score0) + " to " + to_string(g.score);
+        if(err.empty() && (g.turns & 15) == 0 && !g.enemies.empty())
+            err = check_search(g, (int)walk.below((uint32_t)g.enemies.size()), scratch);
+    }
+    stats.games[sg.kind]++;
+    stats.turns[sg.kind] += g.turns;
+    beat.games.fetch_add(1, memory_order_relaxed);
+    if(!err.empty()) err = "stress game " + to_string(i) + " (" + describe_stress_game(sg) + ") turn " + to_string(g.turns) + ": " + err;
+    return err;
+}
+
+double peak_rss_mb(){
+    rusage ru{};
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss / 1024.0; // KiB on Linux
+}
+
+// only >= 0 replays that one game instead of running for `seconds`. Returns 1 on a violation.
+int run_stress(const SimConfig &cfg, double seconds, long long only){
+    int threads = only >= 0 ? 1 : cfg.threads > 0 ? cfg.threads : (int)max(1u, thread::hardware_concurrency());
+    atomic<long long> nextGame{only >= 0 ? only : 0};
+    atomic<bool> stop{false};
+    atomic<int> running{threads};
+    vector<StressStats> perThread(threads);
+    vector<StressBeat> beats(threads);
+    mutex failMutex;
+    string failure;
+    long long failedGame = -1;
+    auto deadline = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(seconds));
+    auto worker = [&](int t){
+        Game g;
+        ChunkWorld world(""); // endless games stay in memory
+        BfsScratch scratch;
+        while(!stop.load(memory_order_relaxed)){
+            long long i = nextGame.fetch_add(1, memory_order_relaxed);
+            if(only >= 0 ? i != only : chrono::steady_clock::now() >= deadline) break;
+            beats[t].game.store(i, memory_order_relaxed);
+            string err = play_stress_game(cfg.seed, i, g, world, scratch, perThread[t], beats[t]);
+            if(!err.empty()){
+                lock_guard<mutex> lk(failMutex);
+                if(failure.empty()){ failure = err; failedGame = i; }
+                stop = true;
+            }
+        }
+        beats[t].game.store(-1, memory_order_relaxed);
+        running--;
+    };
+    auto t0 = chrono::steady_clock::now();
+    vector<thread> pool;
+    for(int t=0;t<threads;t++) pool.emplace_back(worker, t);
+
+    // watchdog and progress: a worker whose turn count stands still for STRESS_STALL_SECONDS is stuck
+    auto nextReport = t0 + chrono::seconds(STRESS_REPORT_SECONDS);
+    while(running.load() > 0){
+        this_thread::sleep_for(chrono::milliseconds(100));
+        auto now = chrono::steady_clock::now();
+        long long gamesNow = 0, turnsNow = 0;
+        for(int t=0;t<threads;t++){
+            long long tn = beats[t].turns.load(memory_order_relaxed), game = beats[t].game.load(memory_order_relaxed);
+            gamesNow += beats[t].games.load(memory_order_relaxed);
+            turnsNow += tn;
+            if(tn != beats[t].seenTurns || game < 0){ beats[t].seenTurns = tn; beats[t].seenAt = now; continue; }
+            if(now - beats[t].seenAt > chrono::seconds(STRESS_STALL_SECONDS)){
+                fprintf(stderr, "stalled: worker %d made no progress for %ds in stress game %lld (%s)\n", t, STRESS_STALL_SECONDS,
+                        game, describe_stress_game(stress_game(cfg.seed, game)).c_str());
+                fprintf(stderr, "reproduce with --stress-game %lld --seed %u\n", game, cfg.seed);
+                fflush(stderr);
+                _exit(1); // the worker cannot be interrupted
+            }
+        }
+        if(now >= nextReport){
+            printf("[%4.0fs] games: %lld  turns: %lld  peak rss: %.1f MB\n", chrono::duration<double>(now - t0).count(),
+                   gamesNow, turnsNow, peak_rss_mb());
+            fflush(stdout);
+            nextReport += chrono::seconds(STRESS_REPORT_SECONDS);
+        }
+    }
+    for(auto &th: pool) th.join();
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+    StressStats total;
+    for(auto &st: perThread){
+        for(int k=0;k<SK_COUNT;k++){ total.games[k] += st.games[k]; total.turns[k] += st.turns[k]; total.turnNs[k].merge(st.turnNs[k]); }
+    }
+    long long games = 0, turns = 0;
+    for(int k=0;k<SK_COUNT;k++){ games += total.games[k]; turns += total.turns[k]; }
+    printf("stress: %lld games  %lld turns  %.1fs  seed: %u  threads: %d\n", games, turns, secs, cfg.seed, threads);
+    printf("%-8s %8s %10s %10s %10s %12s\n", "kind", "games", "turns", "p50 ns", "p99 ns", "max ns");
+    for(int k=0;k<SK_COUNT;k++){
+        const LatencyHistogram &hst = total.turnNs[k];
+        printf("%-8s %8lld %10lld %10llu %10llu %12llu\n", STRESS_KIND_NAMES[k], total.games[k], total.turns[k],
+               (unsigned long long)hst.percentile(0.5), (unsigned long long)hst.percentile(0.99), (unsigned long long)hst.maxNs);
+    }
+    printf("peak rss: %.1f MB\n", peak_rss_mb());
+    if(failure.empty()){ printf("invariants: ok\n"); return 0; }
+    printf("FAILED: %s\n", failure.c_str());
+    printf("reproduce with --stress-game %lld --seed %u\n", failedGame, cfg.seed);
+    return 1;
+}
+
+// --replay: plays every replay in `paths` (files, or directories of *.rpl files) headless as
+// fast as possible, checking the state hash after every turn, and reports throughput.
+// Returns the number of replays that failed to load or diverged.
+int run_replays(const vector<string> &paths){
+    vector<string> files;
+    for(auto &p: paths){
+        DIR *d = opendir(p.c_str());
+        if(!d){ files.push_back(p); continue; }
+        vector<string> found;
+        while(dirent *ent = readdir(d)){
+            string name = ent->d_name;
+            if(name.size() > 4 && name.compare(name.size()-4, 4, ".rpl") == 0) found.push_back(p + "/" + name);
+        }
+        closedir(d);
+        sort(found.begin(), found.end());
+        files.insert(files.end(), found.begin(), found.end());
+    }
+    Replay r;
+    Game g;
+    long long actions = 0;
+    int failed = 0;
+    double secs = 0;
+    for(auto &f: files){
+        if(!load_replay(r, f)){ printf("%s: not a replay file\n", f.c_str()); failed++; continue; }
+        auto t0 = chrono::steady_clock::now();
+        long long bad = play_replay(r, g);
+        secs += chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        actions += bad < 0 ? (long long)r.actions.size() : bad + 1;
+        if(bad >= 0){ printf("%s: diverged at action %lld of %zu\n", f.c_str(), bad, r.actions.size()); failed++; }
+    }
+    printf("replays: %zu  diverged or unreadable: %d  actions: %lld\n", files.size(), failed, actions);
+    printf("elapsed: %.3fs  actions/sec: %.1f\n", secs, actions/max(secs,1e-9));
+    return failed;
+}
+
+// --serve PORT: hosts one game per TCP connection on a single thread. Sockets are non-blocking
+// and multiplexed with epoll, so a session only costs time when its client sends a command or
+// its socket drains; an idle one is just its Game and two frames. Line protocol:
+//   client: w/a/s/d move, q quits; whitespace is ignored and any other byte gets a message
+//   server: F <w> <h>            on connect, followed by the h rows of the map
+//           D <x> <y> <glyphs>   a run of cells on row y that changed since the last reply
+//           S <depth> <hp> <maxhp> <score> <turns>
+//           M <text>             a message, e.g. one of the turn's events
+//           O <score> <turns>    the game is over; the server closes the connection
+//           .                    ends the reply to one command (and the greeting)
+// Once SERVE_OUT_LIMIT bytes of replies wait for a client that stops reading, its commands
+// stop being read too, so TCP pushes back instead of the server buffering without bound.
+const size_t SERVE_OUT_LIMIT = 64 << 10;
+const int SERVE_READ = 512; // bytes of commands taken per wakeup
+volatile sig_atomic_t serveStop = 0;
+
+struct Session {
+    Game g;
+    ostringstream messages;   // the game's text event sink, drained into every reply
+    vector<char> frame, prev; // prev: the frame the client has
+    string out;               // replies not sent yet, from out[sent]
+    size_t sent = 0;
+    uint32_t armed = 0;       // epoll events registered for the socket
+    bool closing = false;     // game over: close once out is sent
+};
+
+// Appends the reply to the last command: the cells that changed (the whole map the first
+// time), the status, the messages logged since the previous reply and the end marker.
+void session_reply(Session &s, bool first){
+    const Game &g = s.g;
+    char line[96];
+    build_frame(g, s.frame);
+    if(first){
+        snprintf(line, sizeof line, "F %d %d\n", g.map.w, g.map.h);
+        s.out += line;
+        for(int y=0;y<g.map.h;y++){ s.out.append(&s.frame[(size_t)y*g.map.w], g.map.w); s.out += '\n'; }
+    } else {
+        for_each_changed_run(s.prev.data(), s.frame.data(), g.map.w, g.map.h, [&](int x, int y, int len){
+            snprintf(line, sizeof line, "D %d %d ", x, y);
+            s.out += line;
+            s.out.append(&s.frame[(size_t)y*g.map.w + x], len);
+            s.out += '\n';
+        });
+    }
+    swap(s.prev, s.frame);
+    snprintf(line, sizeof line, "S %d %d %d %d %d\n", g.depth, g.playerHP, g.playerMaxHP, g.score, g.turns);
+    s.out += line;
+    string text = s.messages.str();
+    s.messages.str("");
+    size_t start = 0;
+    while(start < text.size()){
+        size_t end = text.find('\n', start);
+        if(end==string::npos) end = text.size();
+        s.out += "M ";
+        s.out.append(text, start, end - start);
+        s.out += '\n';
+        start = end + 1;
+    }
+    if(g.over()){
+        snprintf(line, sizeof line, "O %d %d\n", g.score, g.turns);
+        s.out += line;
+    }
+    s.out += ".\n";
+}
+
+// Plays one command byte and queues its reply; whitespace is skipped without one.
+void session_command(Session &s, char ch){
+    Action act;
+    if(ch==' ' || ch=='\n' || ch=='\r' || ch=='\t') return;
+    if(ch=='q' || ch=='Q') act = ACT_QUIT;
+    else if(ch=='w' || ch=='W') act = ACT_UP;
+    else if(ch=='s' || ch=='S') act = ACT_DOWN;
+    else if(ch=='a' || ch=='A') act = ACT_LEFT;
+    else if(ch=='d' || ch=='D') act = ACT_RIGHT;
+    else {
+        if(ch=='p' || ch=='P') s.messages << "Saving is not available over the network.\n";
+        else s.messages << "Unknown input. Use w/a/s/d.\n";
+        session_reply(s, false);
+        return;
+    }
+    step(s.g, act);
+    session_reply(s, false);
+}
+
+// Sends as much of the queued output as the socket takes; false if the connection is gone.
+bool session_send(int fd, Session &s){
+    while(s.sent < s.out.size()){
+        ssize_t n = send(fd, s.out.data() + s.sent, s.out.size() - s.sent, MSG_NOSIGNAL);
+        if(n > 0){ s.sent += (size_t)n; continue; }
+        if(n < 0 && errno==EINTR) continue;
+        if(n < 0 && (errno==EAGAIN || errno==EWOULDBLOCK)) break;
+        return false;
+    }
+    if(s.sent == s.out.size()){ s.out.clear(); s.sent = 0; }
+    else if(s.sent > s.out.size() / 2){ s.out.erase(0, s.sent); s.sent = 0; }
+    return true;
+}
+
+// Seeds the game of session i as --sim seeds game i. Returns 1 if the port cannot be opened.
+int run_server(const SimConfig &cfg, int port, uint64_t baseSeed){
+    int lfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)port);
+    if(lfd < 0 || setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one) < 0
+       || bind(lfd, (sockaddr*)&addr, sizeof addr) < 0 || listen(lfd, SOMAXCONN) < 0){
+        fprintf(stderr, "Could not listen on port %d: %s\n", port, strerror(errno));
+        return 1;
+    }
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event lev{};
+    lev.events = EPOLLIN;
+    lev.data.fd = lfd;
+    epoll_ctl(ep, EPOLL_CTL_ADD, lfd, &lev);
+    // SIGINT/SIGTERM interrupt epoll_wait (no SA_RESTART) so the leaderboard is flushed on the way out
+    struct sigaction sa{};
+    sa.sa_handler = [](int){ serveStop = 1; };
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    Leaderboard board(cfg.scores.empty() ? "highscore.txt" : cfg.scores);
+    // sessions by socket; closed ones go back to `spare` and keep their buffers for the next client
+    deque<Session> pool;
+    vector<Session*> sessions, spare;
+    long long started = 0, finished = 0;
+    int live = 0, peak = 0;
+    bool accepting = true;
+
+    auto rearm = [&](int fd, Session &s){
+        size_t waiting = s.out.size() - s.sent;
+        uint32_t want = (!s.closing && waiting < SERVE_OUT_LIMIT ? (uint32_t)EPOLLIN : 0) | (waiting ? (uint32_t)EPOLLOUT : 0);
+        if(want == s.armed) return;
+        epoll_event e{};
+        e.events = want;
+        e.data.fd = fd;
+        epoll_ctl(ep, EPOLL_CTL_MOD, fd, &e);
+        s.armed = want;
+    };
+    auto drop = [&](int fd){
+        // read off whatever the client still sent, so close() ends with a FIN rather than a reset
+        char junk[SERVE_READ];
+        while(recv(fd, junk, sizeof junk, 0) > 0) {}
+        close(fd);
+        spare.push_back(sessions[fd]);
+        sessions[fd] = nullptr;
+        live--;
+        if(!accepting){ lev.events = EPOLLIN; epoll_ctl(ep, EPOLL_CTL_MOD, lfd, &lev); accepting = true; }
+    };
+    auto accept_all = [&]{
+        while(true){
+            int fd = accept4(lfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(fd < 0){
+                if(errno==EINTR || errno==ECONNABORTED) continue;
+                if(errno==EMFILE || errno==ENFILE){
+                    // out of descriptors: leave the backlog queued until a session closes
+                    fprintf(stderr, "Session limit reached at %d connections\n", live);
+                    lev.events = 0;
+                    epoll_ctl(ep, EPOLL_CTL_MOD, lfd, &lev);
+                    accepting = false;
+                }
+                return;
+            }
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+            if((size_t)fd >= sessions.size()) sessions.resize((size_t)fd + 1, nullptr);
+            if(spare.empty()){ pool.emplace_back(); spare.push_back(&pool.back()); }
+            Session *s = spare.back();
+            spare.pop_back();
+            s->out.clear();
+            s->sent = 0;
+            s->closing = false;
+            new_game(s->g, cfg.diff, cfg.mapW, cfg.mapH, mix_seed(baseSeed ^ mix_seed((uint64_t)started++)),
+                     cfg.customConfig ? &cfg.config : nullptr);
+            s->g.events.text = &s->messages;
+            s->messages.str("");
+            s->messages << "Welcome to the Tiny Roguelike. w/a/s/d to move, q to quit.\n";
+            session_reply(*s, true);
+            epoll_event e{};
+            e.events = s->armed = EPOLLIN;
+            e.data.fd = fd;
+            epoll_ctl(ep, EPOLL_CTL_ADD, fd, &e);
+            sessions[fd] = s;
+            peak = max(peak, ++live);
+            session_send(fd, *s); // a failed send shows up as EPOLLERR on the next wait
+            rearm(fd, *s);
+        }
+    };
+
+    printf("serving on port %d\n", port);
+    fflush(stdout);
+    epoll_event ready[256];
+    while(!serveStop){
+        int n = epoll_wait(ep, ready, 256, -1);
+        if(n < 0){ if(errno==EINTR) continue; break; }
+        for(int k=0;k<n;k++){
+            int fd = ready[k].data.fd;
+            uint32_t evs = ready[k].events;
+            if(fd == lfd){ accept_all(); continue; }
+            Session *s = (size_t)fd < sessions.size() ? sessions[fd] : nullptr;
+            if(!s) continue;
+            bool alive = !(evs & EPOLLERR) && ((evs & EPOLLIN) || !(evs & EPOLLHUP));
+            if(alive && (evs & EPOLLIN) && !s->closing){
+                char buf[SERVE_READ];
+                ssize_t got = recv(fd, buf, sizeof buf, 0);
+                if(got == 0 || (got < 0 && errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR)) alive = false;
+                for(ssize_t i=0;i<got && !s->closing;i++){
+                    session_command(*s, buf[i]);
+                    if(s->g.over()){
+                        s->closing = true;
+                        board.submit(score_entry(s->g));
+                        board.maybe_flush(64);
+                        finished++;
+                    }
+                }
+            }
+            if(alive) alive = session_send(fd, *s) && !(s->closing && s->out.empty());
+            if(alive) rearm(fd, *s);
+            else drop(fd);
+        }
+    }
+    for(size_t fd=0;fd<sessions.size();fd++) if(sessions[fd]) close((int)fd);
+    close(ep);
+    close(lfd);
+    board.flush(true);
+    printf("sessions: %lld  finished: %lld  peak concurrent: %d\n", started, finished, peak);
+    if(!cfg.profile.empty() && !tl_profile.save_json(cfg.profile)) fprintf(stderr, "Could not write %s\n", cfg.profile.c_str());
+    return 0;
+}
+
+// --bench: micro-benchmarks for the hot paths. Every case is set up from the base seed, so two
+// runs with the same seed measure exactly the same work. Each case is calibrated to run for at
+// least ~20ms per repetition; the median of 5 repetitions is reported as ns/op, with heap
+// allocations/op counted by the operator new hook above.
+struct BenchResult { double nsPerOp; double allocsPerOp; long long iters; };
+
+// results of benchmarked calls are folded in here so the optimiser cannot drop the calls
+volatile long long benchSink = 0;
+void bench_keep(pair<int,int> p){ benchSink = benchSink + p.first * 31 + p.second; }
+
+// op(n) runs n iterations; opsPerIter > 1 when an iteration is a batch of several ops.
+template<class Op>
+BenchResult bench_case(Op op, int opsPerIter = 1){
+    long long iters = 1;
+    while(true){
+        auto t0 = chrono::steady_clock::now();
+        op(iters);
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        if(secs >= 0.02 || iters >= (1ll<<30)) break;
+        iters *= 2;
+    }
+    vector<double> ns;
+    uint64_t allocs = 0;
+    for(int rep=0; rep<5; rep++){
+        uint64_t a0 = tl_allocs;
+        auto t0 = chrono::steady_clock::now();
+        op(iters);
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        allocs += tl_allocs - a0;
+        ns.push_back(secs * 1e9 / iters);
+    }
+    sort(ns.begin(), ns.end());
+    return {ns[ns.size()/2] / opsPerIter, (double)allocs / (5.0 * iters * opsPerIter), iters * opsPerIter};
+}
+
+void print_bench(const string &name, const BenchResult &r){
+    printf("%-44s %14.1f ns/op %10.2f allocs/op %12lld iters\n", name.c_str(), r.nsPerOp, r.allocsPerOp, r.iters);
+    fflush(stdout);
+}
+
+// Replaces g's enemies with `count` enemies on distinct floor tiles (never the player's), with
+// the HP g's difficulty gives them. bench_respawn keeps the population at `count` as they die.
+void bench_populate(Game &g, int count, Rng &rng){
+    g.items.clear();
+    g.floors.build(g.map);
+    g.floors.exclude(g.map.idx(g.playerX, g.playerY));
+    g.enemies.clear();
+    for(int i=0;i<count;i++){
+        int c = g.floors.sample(rng);
+        if(c < 0) break;
+        g.enemies.push(g.map.x_of(c), g.map.y_of(c), rnd(rng, g.config.enemyHpMin, g.config.enemyHpMax));
+    }
+    g.occ.reset(g.map, g.enemies, g.items);
+    g.scratch.reset(g.map, g.enemies.size());
+}
+
+// Puts new enemies on random free tiles of `cells` until g has `count` again. `cells` must hold
+// more tiles than `count` plus the player's.
+void bench_respawn(Game &g, size_t count, const vector<int> &cells, Rng &rng){
+    while(g.enemies.size() < count){
+        int c = cells[rng.below((uint32_t)cells.size())];
+        if(g.occ.enemy[c] != -1 || c == g.map.idx(g.playerX, g.playerY)) continue;
+        g.occ.enemy[c] = (int)g.enemies.size();
+        g.enemies.push(g.map.x_of(c), g.map.y_of(c), rnd(rng, g.config.enemyHpMin, g.config.enemyHpMax));
+    }
+}
+
+void run_bench(unsigned seed){
+    printf("seed: %u\n", seed);
+    const pair<int,int> sizes[] = {{20,10}, {128,64}, {512,512}};
+    const int enemyCounts[] = {8, 64, 512};
+    for(auto sz: sizes){
+        int w = sz.first, h = sz.second;
+        string dims = to_string(w) + "x" + to_string(h);
+        Rng rng(mix_seed(seed ^ (uint64_t)w << 32 ^ (uint64_t)h));
+
+        Grid map; map.resize(w, h);
+        LevelVec<Rect> rooms;
+        print_bench("generate_map_basic/" + dims, bench_case([&](long long n){
+            for(long long i=0;i<n;i++) generate_map_basic(map, rooms, rng);
+        }));
+        LevelState lvl;
+        int depth = 0;
+        print_bench("generate_level/" + dims, bench_case([&](long long n){
+            for(long long i=0;i<n;i++) generate_level(lvl, diffConfigs[NORMAL], w, h, seed, ++depth);
+        }));
+        // save files: serialising, and restoring from an in-memory image (what a mapped file gives)
+        Game fixture, restored;
+        new_game(fixture, NORMAL, w, h, mix_seed(seed));
+        vector<uint8_t> image;
+        print_bench("snapshot_write/" + dims, bench_case([&](long long n){
+            for(long long i=0;i<n;i++){ write_snapshot(fixture, image); bench_keep({(int)image.size(), image[0]}); }
+        }));
+        SnapshotView view;
+        view.open(image.data(), image.size());
+        print_bench("snapshot_restore/" + dims, bench_case([&](long long n){
+            for(long long i=0;i<n;i++){ restore_snapshot(restored, view); bench_keep({restored.playerX, (int)restored.enemies.size()}); }
+        }));
+        // alternating the radius defeats the cache, so every call is a full shadowcast
+        Fov fov;
+        fov.reset(fixture.map);
+        print_bench("fov/" + dims, bench_case([&](long long n){
+            for(long long i=0;i<n;i++){
+                fov.update(fixture.map, fixture.playerX, fixture.playerY, ACTIVATION_RADIUS + (int)(i & 1));
+                bench_keep({(int)fov.gen, fov.root});
+            }
+        }));
+        // post-generation connectivity check on packed rows
+        BitFlood flood;
+        print_bench("flood/" + dims, bench_case([&](long long n){
+            for(long long i=0;i<n;i++){ flood.load(fixture.map); bench_keep({flood.reach(fixture.startX, fixture.startY), 0}); }
+        }));
+        // region labelling of a split map, paid by the rare new floor, restored save or chunk
+        // window the flood above leaves tiles behind on
+        Components comps;
+        print_bench("components/" + dims, bench_case([&](long long n){
+            for(long long i=0;i<n;i++){
+                flood.load(fixture.map);
+                comps.build(fixture.map, flood);
+                bench_keep({comps.count, comps.size[0]});
+            }
+        }));
+
+        for(int count: enemyCounts){
+            Game g;
+            new_game(g, NORMAL, w, h, mix_seed(seed ^ (uint64_t)count));
+            bench_populate(g, count, rng);
+            if((int)g.enemies.size() < count) continue; // map too small for this population
+            string tag = "/" + dims + "/enemies=" + to_string(count);
+
+            BfsScratch scratch;
+            print_bench("bfs_next_step" + tag, bench_case([&](long long n){
+                for(long long i=0;i<n;i++){
+                    size_t k = i % g.enemies.size();
+                    bench_keep(bfs_next_step(g.map, g.enemies.x[k], g.enemies.y[k], g.playerX, g.playerY, g.occ, scratch, &g.comps));
+                }
+            }));
+            // one whole planning pass: refill the field after a player move, then every enemy reads it
+            int ax = g.playerX, ay = g.playerY, bx = ax, by = ay;
+            for(auto d: {make_pair(1,0), make_pair(-1,0), make_pair(0,1), make_pair(0,-1)})
+                if(g.map.floor(ax+d.first, ay+d.second) && g.occ.enemy[g.map.idx(ax+d.first, ay+d.second)]==-1){
+                    bx = ax+d.first; by = ay+d.second; break;
+                }
+            g.field.reset(g.map, ax, ay);
+            print_bench("field_plan" + tag, bench_case([&](long long n){
+                for(long long i=0;i<n;i++){
+                    bool there = i & 1;
+                    int px = there ? bx : ax, py = there ? by : ay;
+                    g.field.move_root(g.map, px, py);
+                    for(size_t k=0;k<g.enemies.size();k++)
+                        bench_keep(field_next_step(g.map, g.field, g.enemies.x[k], g.enemies.y[k], px, py, g.occ));
+                }
+            }));
+            g.field.reset(g.map, ax, ay);
+            if(count == enemyCounts[0]){
+                print_bench("field_reset/" + dims, bench_case([&](long long n){
+                    for(long long i=0;i<n;i++) g.field.reset(g.map, g.playerX, g.playerY);
+                }));
+                // the room-graph counterpart of a field reset: Dijkstra toward one room (two goals
+                // alternate so the two cached tables never answer)
+                int goals[3] = {0, (int)g.rooms.size()/2, (int)g.rooms.size()-1};
+                print_bench("room_table/" + dims, bench_case([&](long long n){
+                    for(long long i=0;i<n;i++) bench_keep({g.graph.table(g.rooms, goals[i % 3]).dist[0], 0});
+                }));
+            }
+            // long-range steps toward the player from every enemy, with the player's table cached
+            const RoomGraph::Goal goal = g.graph.aim(g.rooms, g.playerX, g.playerY);
+            print_bench("room_step" + tag, bench_case([&](long long n){
+                for(long long i=0;i<n;i++){
+                    size_t k = i % g.enemies.size();
+                    bench_keep(g.graph.next_step(g.rooms, goal, g.enemies.x[k], g.enemies.y[k]));
+                }
+            }));
+            // Complete turns, all doing the same kind of work: `count` awake enemies chase a moving
+            // player. They start on the floor tiles nearest the player and respawn among the 2*count
+            // nearest as they are killed. The player walks a fixed route up to 8 tiles out from its
+            // start and back, attacking whatever stands in the way. Every 16 turns the player and the
+            // enemies are put back on their start tiles, so the enemies do not all end up jammed
+            // around the player (copying into vectors with enough capacity does not allocate).
+            const int turnsPerIter = 16;
+            const int homeX = g.playerX, homeY = g.playerY;
+            const DistanceField &f = g.field; // rooted at home
+            vector<int> near;
+            for(int c: g.floors.cells) if(f.dist[c] != DistanceField::UNREACHED && f.dist[c] > 0) near.push_back(c);
+            if(near.size() < (size_t)count + 2) continue; // too few reachable tiles to respawn on
+            sort(near.begin(), near.end(), [&](int a, int b){ return f.dist[a] < f.dist[b] || (f.dist[a] == f.dist[b] && a < b); });
+            near.resize(min(near.size(), (size_t)count * 2));
+            vector<Action> route;
+            {
+                const int dirs[4] = {-g.map.stride, g.map.stride, -1, 1}; // indexed by Action
+                int far = g.map.idx(homeX, homeY);
+                for(int c: g.floors.cells)
+                    if(f.dist[c] != DistanceField::UNREACHED && f.dist[c] <= turnsPerIter/2 && f.dist[c] > f.dist[far]) far = c;
+                // walk downhill from the far end; each step taken backwards is the reverse move out
+                vector<Action> back;
+                for(int cur = far; f.dist[cur] > 0; ){
+                    for(int a=0;a<4;a++) if(f.dist[cur+dirs[a]] == f.dist[cur]-1){ cur += dirs[a]; back.push_back((Action)a); break; }
+                }
+                for(size_t k=back.size(); k-- > 0; ) route.push_back((Action)(back[k] ^ 1)); // UP<->DOWN, LEFT<->RIGHT
+                route.insert(route.end(), back.begin(), back.end());
+                if(route.empty()) route.push_back(ACT_RIGHT); // walled in: bump the wall
+            }
+            g.enemies.clear();
+            for(int k=0;k<count;k++) g.enemies.push(g.map.x_of(near[k]), g.map.y_of(near[k]), rnd(rng, g.config.enemyHpMin, g.config.enemyHpMax));
+            g.occ.reset(g.map, g.enemies, g.items);
+            const EnemyList start = g.enemies;
+            Rng spawnRng(mix_seed(seed ^ 7));
+            print_bench("turn" + tag, bench_case([&](long long n){
+                for(long long i=0;i<n;i++){
+                    for(size_t k=0;k<g.enemies.size();k++) g.occ.enemy[g.map.idx(g.enemies.x[k], g.enemies.y[k])] = -1;
+                    g.enemies = start;
+                    for(size_t k=0;k<start.size();k++) g.occ.enemy[g.map.idx(start.x[k], start.y[k])] = (int)k;
+                    g.playerX = homeX; g.playerY = homeY;
+                    for(int t=0;t<turnsPerIter;t++){
+                        g.playerHP = g.playerMaxHP = 999;
+                        step(g, route[t % route.size()]);
+                        bench_respawn(g, start.size(), near, spawnRng);
+                    }
+                }
+            }, turnsPerIter));
+        }
+    }
+    // the batch driver against the same games stepped by hand (ns per game step), random actions,
+    // games restarting as they end
+    for(int count: {64, 1024}){
+        string tag = "/games=" + to_string(count);
+        Rng actRng(mix_seed(seed ^ 0xAC7));
+        vector<uint8_t> actions(count);
+        BatchEnv env;
+        env.reset(count, NORMAL, MAP_W, MAP_H, seed);
+        print_bench("batch_step" + tag, bench_case([&](long long n){
+            for(long long i=0;i<n;i++){
+                for(auto &a: actions) a = (uint8_t)actRng.below(4);
+                env.step(actions.data());
+            }
+        }, count));
+        vector<Game> games(count);
+        long long started = 0;
+        auto start = [&](Game &g){
+            g.floorLimit = 1;
+            new_game(g, NORMAL, MAP_W, MAP_H, mix_seed(seed ^ mix_seed((uint64_t)started++)));
+        };
+        for(auto &g: games) start(g);
+        print_bench("single_step" + tag, bench_case([&](long long n){
+            for(long long i=0;i<n;i++){
+                for(auto &a: actions) a = (uint8_t)actRng.below(4);
+                for(int k=0;k<count;k++){
+                    Game &g = games[k];
+                    replay_step(g, (Action)actions[k], REPLAY_WASTED_TURNS);
+                    if(g.over() || g.turns >= 1000 || g.cleared()) start(g);
+                }
+            }
+        }, count));
+    }
+    // a busy turn's events (four per op) with no sink and with the counter sink
+    {
+        EventLog events;
+        EventCounts counts;
+        for(int withSink=0; withSink<2; withSink++){
+            events.counts = withSink ? &counts : nullptr;
+            print_bench(withSink ? "events/counts" : "events/no_sink", bench_case([&](long long n){
+                for(long long i=0;i<n;i++){
+                    events.push(EV_PLAYER_HIT, 4);
+                    events.push(EV_ENEMY_WOUNDED, (int)i);
+                    events.push(EV_ENEMY_ATTACK, 2);
+                    events.push(EV_ENEMY_ATTACK, 3);
+                    events.flush((int)i);
+                }
+                bench_keep({(int)counts.damageTaken, 0});
+            }));
+        }
+    }
+    // endless world: the window moving one chunk east and back, both windows in the chunk cache
+    {
+        Game g;
+        ChunkWorld world(""); // nothing to disk
+        g.world = &world;
+        new_game(g, NORMAL, MAP_W, MAP_H, mix_seed(seed));
+        int dims = ChunkWorld::WINDOW * ChunkWorld::SIZE;
+        print_bench("chunk_recenter/" + to_string(dims) + "x" + to_string(dims), bench_case([&](long long n){
+            for(long long i=0;i<n;i++){
+                g.playerX += i % 2 ? -ChunkWorld::SIZE : ChunkWorld::SIZE;
+                world.recenter(g);
+                bench_keep({g.playerX, (int)g.enemies.size()});
+            }
+        }));
+        // walking east for good: every recenter generates a column of new chunks
+        print_bench("chunk_generate/" + to_string(ChunkWorld::WINDOW) + "_per_op", bench_case([&](long long n){
+            for(long long i=0;i<n;i++){
+                g.playerX += ChunkWorld::SIZE;
+                world.recenter(g);
+                bench_keep({g.playerX, (int)g.enemies.size()});
+            }
+        }));
+    }
+}
+
+int main(int argc, char **argv){
+    ios::sync_with_stdio(false);
+    cin.tie(nullptr);
+
+    SimConfig sim;
+    bool seedGiven = false;
+    bool bench = false;
+    int servePort = 0;
+    double stressSeconds = -1;
+    long long stressGame = -1;
+    int mapW = MAP_W, mapH = MAP_H;
+    string loadPath, profilePath, recordPath, configPath, exploreDir, eventsPath;
+    vector<string> replays;
+    for(int i=1;i<argc;i++){
+        string arg = argv[i];
+        if(arg=="--size" && i+1<argc){
+            if(sscanf(argv[++i], "%dx%d", &mapW, &mapH)!=2){ cerr << "Usage: --size WxH\n"; return 1; }
+            mapW = max(mapW, MIN_MAP_W); mapH = max(mapH, MIN_MAP_H);
+        } else if(arg=="--sim" && i+1<argc){
+            sim.games = max(0, atoi(argv[++i]));
+        } else if(arg=="--bench"){
+            bench = true;
+        } else if(arg=="--threads" && i+1<argc){
+            sim.threads = max(0, atoi(argv[++i]));
+        } else if(arg=="--seed" && i+1<argc){
+            sim.seed = (unsigned)strtoul(argv[++i], nullptr, 10);
+            seedGiven = true;
+        } else if(arg=="--diff" && i+1<argc){
+            int d = atoi(argv[++i]);
+            sim.diff = d==1 ? EASY : (d==3 ? HARD : NORMAL);
+        } else if(arg=="--max-turns" && i+1<argc){
+            sim.maxTurns = max(1, atoi(argv[++i]));
+        } else if(arg=="--floors" && i+1<argc){
+            sim.floors = max(0, atoi(argv[++i]));
+        } else if(arg=="--script" && i+1<argc){
+            sim.script = argv[++i];
+        } else if(arg=="--scores" && i+1<argc){
+            sim.scores = argv[++i];
+        } else if(arg=="--profile" && i+1<argc){
+            profilePath = sim.profile = argv[++i];
+        } else if(arg=="--record" && i+1<argc){
+            recordPath = sim.recordDir = argv[++i];
+        } else if(arg=="--replay" && i+1<argc){
+            replays.push_back(argv[++i]);
+        } else if(arg=="--config" && i+1<argc){
+            configPath = argv[++i];
+        } else if(arg=="--load" && i+1<argc){
+            loadPath = argv[++i];
+        } else if(arg=="--explore" && i+1<argc){
+            exploreDir = argv[++i];
+        } else if(arg=="--events" && i+1<argc){
+            eventsPath = argv[++i];
+        } else if(arg=="--stress" && i+1<argc){
+            stressSeconds = max(0.0, atof(argv[++i]));
+        } else if(arg=="--stress-game" && i+1<argc){
+            stressGame = max(0ll, atoll(argv[++i]));
+        } else if(arg=="--serve" && i+1<argc){
+            servePort = atoi(argv[++i]);
+            if(servePort <= 0 || servePort > 65535){ cerr << "Usage: --serve PORT\n"; return 1; }
+        } else {
+            cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+    DiffConfig configs[3] = {diffConfigs[0], diffConfigs[1], diffConfigs[2]};
+    if(!configPath.empty() && !load_diff_config(configPath, configs)) return 1;
+    if(bench){
+        run_bench(sim.seed);
+        return 0;
+    }
+    if(!replays.empty()) return run_replays(replays) ? 1 : 0;
+    if(stressSeconds >= 0 || stressGame >= 0) return run_stress(sim, max(stressSeconds, 0.0), stressGame);
+    // saves and replays hold one floor, not a world of chunks
+    if(!exploreDir.empty() && (!loadPath.empty() || !recordPath.empty())){
+        cerr << "--explore cannot be combined with --load or --record\n";
+        return 1;
+    }
+    if(servePort){
+        // sessions are plain games: no save files, replays, event logs or chunk directories per client
+        if(sim.games > 0 || !loadPath.empty() || !recordPath.empty() || !exploreDir.empty() || !eventsPath.empty()){
+            cerr << "--serve cannot be combined with --sim, --load, --record, --explore or --events\n";
+            return 1;
+        }
+        sim.mapW = mapW; sim.mapH = mapH;
+        if(!configPath.empty()){ sim.customConfig = true; sim.config = configs[sim.diff]; }
+        uint64_t seed = seedGiven ? sim.seed : (uint64_t)chrono::high_resolution_clock::now().time_since_epoch().count();
+        return run_server(sim, servePort, seed);
+    }
+    if(sim.games > 0){
+        sim.mapW = mapW; sim.mapH = mapH;
+        if(!configPath.empty()){ sim.customConfig = true; sim.config = configs[sim.diff]; }
+        if(!sim.recordDir.empty()) mkdir(sim.recordDir.c_str(), 0755);
+        if(!exploreDir.empty()){ sim.exploreDir = exploreDir; mkdir(exploreDir.c_str(), 0755); }
+        run_sim(sim);
+        return 0;
+    }
+
+    Game g;
+    optional<ChunkWorld> world;
+    if(!exploreDir.empty()){ world.emplace(exploreDir); g.world = &*world; }
+    if(!loadPath.empty()){
+        if(!load_snapshot(g, loadPath)){ cerr << "Could not load save file " << loadPath << "\n"; return 1; }
+    } else {
+        // Choose difficulty
+        cout << "Choose difficulty: 1) Easy  2) Normal  3) Hard  : ";
+        int dchoice = 2;
+        if(!(cin>>dchoice)) return 0;
+        Difficulty diff = NORMAL;
+        if(dchoice==1) diff = EASY;
+        else if(dchoice==3) diff = HARD;
+        // regenerate map according to difficulty (initial placement)
+        uint64_t seed = seedGiven ? sim.seed : (uint64_t)chrono::high_resolution_clock::now().time_since_epoch().count();
+        new_game(g, diff, mapW, mapH, seed, configPath.empty() ? nullptr : &configs[diff]);
+    }
+
+    // on a terminal, draw incrementally and collect each turn's messages for the message area
+    bool ansi = isatty(STDOUT_FILENO);
+    TermRenderer term;
+    ostringstream messages;
+    ostream &say = ansi ? (ostream&)messages : cout; // the game's events and the UI's own replies
+    g.events.text = &say;
+    ofstream eventFile;
+    if(!eventsPath.empty()){
+        eventFile.open(eventsPath, ios::binary | ios::trunc);
+        if(!eventFile){ cerr << "Could not write " << eventsPath << "\n"; return 1; }
+        write_event_header(eventFile);
+        g.events.binary = &eventFile;
+    }
+    // floors below the current one are built in the background so descending is instant
+    optional<LevelPipeline> pipeline;
+    if(!g.world){
+        pipeline.emplace(g.config, g.map.w, g.map.h, g.seed, g.depth + 1, 1, 2);
+        g.pipeline = &*pipeline;
+    }
+    const string saveFile = "savegame.bin";
+    Replay rec;
+    rec.begin(g, 0, !loadPath.empty());
+
+    Leaderboard board("highscore.txt");
+    int highScore = board.best();
+
+    // main loop
+    while(true){
+        PROFILE_PHASES(phases);
+        PROFILE_SWITCH(phases, PH_RENDER);
+        if(ansi){
+            term.draw(g, highScore, messages.str(), g.playerHP > 0);
+            messages.str("");
+        } else {
+            render(g, highScore);
+        }
+        if(g.playerHP <= 0){
+            cout << "You died! Final score: " << g.score << "   Turns: " << g.turns << "\n";
+            board.submit(score_entry(g));
+            if (g.score > highScore) {
+                cout << "New high score!\n";
+            } else {
+                cout << "High score: " << highScore << "\n";
+            }
+            break;
+        }
+        if(!ansi) cout << MOVE_PROMPT;
+        PROFILE_SWITCH(phases, PH_INPUT);
+        char ch; if(!(cin>>ch)) break;
+        PROFILE_STOP(phases);
+        Action act;
+        if(ch=='q' || ch=='Q') act = ACT_QUIT;
+        else if(ch=='w' || ch=='W') act = ACT_UP;
+        else if(ch=='s' || ch=='S') act = ACT_DOWN;
+        else if(ch=='a' || ch=='A') act = ACT_LEFT;
+        else if(ch=='d' || ch=='D') act = ACT_RIGHT;
+        else if(ch=='p' || ch=='P'){
+            if(g.world) say << "Saving is not available in an endless world.\n";
+            else if(save_snapshot(g, saveFile)) say << "Game saved to " << saveFile << ".\n";
+            else say << "Could not write " << saveFile << ".\n";
+            continue;
+        } else {
+            say << "Unknown input. Use w/a/s/d.\n";
+            continue;
+        }
+        step(g, act);
+        if(!recordPath.empty()) rec.record(act, g);
+        if(g.quit){
+            cout << "Quitting. Final score: " << g.score << "\n";
+            board.submit(score_entry(g));
+            if (g.score > highScore) cout << "New high score!\n";
+            break;
+        }
     }
 
+    if(!profilePath.empty() && !tl_profile.save_json(profilePath)) cerr << "Could not write " << profilePath << "\n";
+    if(!recordPath.empty() && !save_replay(rec, recordPath)) cerr << "Could not write " << recordPath << "\n";
     cout << "Thanks for playing!\n";
     return 0;
 }